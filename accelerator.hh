@@ -0,0 +1,71 @@
+///////////////////////////////////////////////////////////////////////////////
+// accelerator.hh
+//
+// Accelerator dispatch for the exhaustive search and the dp, with the
+// same answers as gray_code_max_protein and dp_max_protein, so batch
+// jobs can ask for the best accelerator there is.
+//
+// Only the host is built in so far. Accelerator::cuda names the place
+// a GPU backend plugs in; it is never available, so requests for it
+// run on the host and callers never need to check.
+//
+// How to use:
+//
+//    // on the best accelerator there is, else on the host
+//    IndexVector plan = accelerated_exhaustive_max_protein(table, 2000);
+//    plan = accelerated_dp_max_protein(table, 200000);
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "maxprotein.hh"
+
+// Where a solver runs.
+enum class Accelerator {
+  host,
+  cuda
+};
+
+const char* accelerator_name(Accelerator accelerator) {
+  switch (accelerator) {
+  case Accelerator::host: return "host";
+  case Accelerator::cuda: return "cuda";
+  }
+  return "unknown";
+}
+
+// Whether solvers can run on accelerator in this process.
+bool accelerator_available(Accelerator accelerator) {
+  switch (accelerator) {
+  case Accelerator::host:
+    return true;
+  case Accelerator::cuda:
+    return false;
+  }
+  return false;
+}
+
+// The fastest accelerator available.
+Accelerator best_accelerator() {
+  return accelerator_available(Accelerator::cuda) ? Accelerator::cuda : Accelerator::host;
+}
+
+// Compute the same optimal set of foods as gray_code_max_protein on
+// accelerator, falling back to gray_code_max_protein on the host. The
+// size of the table must be less than 64.
+IndexVector accelerated_exhaustive_max_protein(const FoodTable& foods,
+					       int total_kcal,
+					       Accelerator accelerator = best_accelerator()) {
+	(void) accelerator;
+	return gray_code_max_protein(foods, total_kcal);
+}
+
+// Compute the same optimal set of foods as dp_max_protein on
+// accelerator, falling back to dp_max_protein on the host.
+IndexVector accelerated_dp_max_protein(const FoodTable& foods,
+				       int total_kcal,
+				       Accelerator accelerator = best_accelerator()) {
+	(void) accelerator;
+	return dp_max_protein(foods, total_kcal);
+}
@@ -0,0 +1,215 @@
+///////////////////////////////////////////////////////////////////////////////
+// anytime.hh
+//
+// A max-protein solver that can be stopped at any time. It returns the
+// best set of foods found so far, with a proven upper bound on the
+// optimum so the caller knows how far from optimal that set may be.
+//
+// How to use:
+//
+//    CancellationToken cancel;  // another thread may call cancel.cancel()
+//    AnytimeResult answer = anytime_max_protein(foods, 2000, 0.010, &cancel);
+//    // answer.foods is within 2000 kcal, and no set of foods within
+//    // 2000 kcal has more than answer.upper_bound grams of protein
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "maxprotein.hh"
+
+// A flag that one thread sets to ask work running on other threads to
+// stop early.
+class CancellationToken {
+public:
+  CancellationToken() : _cancelled(false) { }
+
+  CancellationToken(const CancellationToken&) = delete;
+  CancellationToken& operator=(const CancellationToken&) = delete;
+
+  void cancel() { _cancelled.store(true, std::memory_order_relaxed); }
+  bool cancelled() const { return _cancelled.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<bool> _cancelled;
+};
+
+// The answer of anytime_max_protein.
+struct AnytimeResult {
+  // positions of the chosen foods in increasing order, and their totals
+  IndexVector foods;
+  int kcal = 0;
+  int protein_g = 0;
+  // No set of foods within the budget has more protein than this.
+  int upper_bound = 0;
+  // Nodes visited by the branch and bound search, and whether it
+  // finished before the deadline.
+  uint64_t nodes = 0;
+  bool complete = false;
+
+  // Whether foods is proven optimal.
+  bool optimal() const { return protein_g == upper_bound; }
+
+  // Largest fraction of the optimum that foods may fall short by.
+  double gap() const {
+    return (upper_bound == 0) ? 0.0 : double(upper_bound - protein_g) / upper_bound;
+  }
+};
+
+// Improve chosen, a set of the foods with the given kcal and protein
+// within total_kcal, by local search. A food that still fits is added,
+// and a chosen food is swapped for an unchosen one when that gains
+// protein and still fits, until no such move helps or stop() returns
+// true.
+void local_search_max_protein(std::vector<bool>& chosen,
+			      const std::vector<int>& kcal,
+			      const std::vector<int>& protein,
+			      int total_kcal,
+			      const std::function<bool()>& stop) {
+	const size_t m = kcal.size();
+	// kept beside chosen, so a swap looks at only the chosen foods
+	std::vector<size_t> members;
+	int used = 0;
+	for (size_t i = 0; i < m; i++)
+	{
+		if (chosen[i])
+		{
+			members.push_back(i);
+			used += kcal[i];
+		}
+	}
+	for (bool improved = true; improved; )
+	{
+		improved = false;
+		for (size_t j = 0; j < m; j++)
+		{
+			if ((j % 64) == 0 && stop())
+				return;
+			if (chosen[j])
+				continue;
+			if (used + kcal[j] <= total_kcal)
+			{
+				chosen[j] = true;
+				members.push_back(j);
+				used += kcal[j];
+				improved = true;
+				continue;
+			}
+			// the chosen food whose swap for j gains the most
+			size_t out = members.size();
+			for (size_t k = 0; k < members.size(); k++)
+			{
+				const size_t i = members[k];
+				if (protein[i] < protein[j] &&
+				    used - kcal[i] + kcal[j] <= total_kcal &&
+				    (out == members.size() || protein[i] < protein[members[out]]))
+					out = k;
+			}
+			if (out != members.size())
+			{
+				const size_t i = members[out];
+				chosen[i] = false;
+				chosen[j] = true;
+				members[out] = j;
+				used += kcal[j] - kcal[i];
+				improved = true;
+			}
+		}
+	}
+}
+
+// Find a set of foods within total_kcal with as much protein as
+// possible before deadline, or before cancel is cancelled if it is
+// non-null.
+//
+// The search is seeded with the better of two greedy sets: the one
+// greedy_max_protein picks, by decreasing protein, and the one picked
+// by decreasing protein/kcal density. Local search improves the seed,
+// and then branch_and_bound_max_protein's search continues from it
+// until it finishes or time runs out. The upper bound is the greatest
+// fractional knapsack bound among the subtrees left unexplored, so it
+// tightens as the search goes on, and meets the protein total once
+// the search finishes. The deadline is checked with steady_clock every
+// 1024 search nodes, so the solver may overrun it by a few
+// microseconds.
+AnytimeResult anytime_max_protein(const FoodTable& foods,
+				  int total_kcal,
+				  std::chrono::steady_clock::time_point deadline,
+				  const CancellationToken* cancel = nullptr) {
+	INSTRUMENT_SCOPE(Phase::anytime);
+	AnytimeResult result;
+	if (total_kcal < 0)
+	{
+		result.complete = true;
+		return result;
+	}
+	const std::function<bool()> stop = [&]() {
+		return (cancel != nullptr && cancel->cancelled()) ||
+		       std::chrono::steady_clock::now() >= deadline;
+	};
+
+	BranchAndBoundWorkspace workspace;
+	prepare_branch_and_bound(workspace, foods, total_kcal);
+	const IndexVector& order = workspace.order;
+	const size_t m = order.size();
+
+	// the greedy seeds, as sets of positions in order
+	std::vector<size_t> rank(foods.size(), m);
+	for (size_t i = 0; i < m; i++)
+		rank[order[i]] = i;
+	std::vector<bool> by_protein(m, false), by_density(m, false);
+	int protein_total = 0, density_total = 0;
+	for (size_t i : heap_greedy_max_protein(foods, total_kcal))
+	{
+		by_protein[rank[i]] = true;
+		protein_total += foods.protein_g(i);
+	}
+	for (size_t i = 0, used = 0; i < m; i++)
+	{
+		if (used + workspace.kcal[i] <= size_t(total_kcal))
+		{
+			by_density[i] = true;
+			used += workspace.kcal[i];
+			density_total += workspace.protein[i];
+		}
+	}
+	std::vector<bool>& seed = (protein_total >= density_total) ? by_protein : by_density;
+	local_search_max_protein(seed, workspace.kcal, workspace.protein, total_kcal, stop);
+
+	BranchAndBoundStats stats;
+	const std::vector<bool>& chosen = workspace.search.run(workspace.kcal,
+							       workspace.protein,
+							       total_kcal,
+							       stats,
+							       &seed,
+							       &stop);
+	for (size_t i = 0; i < m; i++)
+	{
+		if (chosen[i])
+			result.foods.push_back(order[i]);
+	}
+	std::sort(result.foods.begin(), result.foods.end());
+	sum_food_table(result.kcal, result.protein_g, foods, result.foods);
+	result.upper_bound = workspace.search.upper_bound();
+	result.nodes = stats.nodes;
+	INSTRUMENT_COUNT(Counter::search_nodes, stats.nodes);
+	INSTRUMENT_COUNT(Counter::search_pruned, stats.pruned);
+	result.complete = !workspace.search.stopped();
+	return result;
+}
+
+// Same as above, with a deadline time_limit seconds from now.
+AnytimeResult anytime_max_protein(const FoodTable& foods,
+				  int total_kcal,
+				  double time_limit,
+				  const CancellationToken* cancel = nullptr) {
+	const auto deadline = std::chrono::steady_clock::now() +
+		std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(time_limit));
+	return anytime_max_protein(foods, total_kcal, deadline, cancel);
+}
@@ -0,0 +1,200 @@
+///////////////////////////////////////////////////////////////////////////////
+// async.hh
+//
+// Solve max-protein queries in the background, so a request-serving
+// thread does not block on an exact solver for seconds.
+//
+// Queries run on a ThreadPool, by default one shared bounded pool, and
+// each returns a std::future. Greedy queries are queued at a higher
+// priority than the exact ones, which can be slow. A query can be
+// cancelled with a CancellationToken; the solvers check it as they go,
+// so a cancelled query frees its worker soon after.
+//
+// How to use:
+//
+//    auto cancel = std::make_shared<CancellationToken>();
+//    std::future<AsyncResult> answer =
+//      solve_async(table, 2000, Solver::gray_code, cancel);
+//    ...
+//    cancel->cancel();  // if the client went away
+//    AsyncResult result = answer.get();  // result.cancelled tells
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+
+#include "anytime.hh"
+#include "maxprotein.hh"
+#include "threadpool.hh"
+
+// Greatest number of queries waiting in the shared pool.
+const size_t ASYNC_QUEUE_CAPACITY = 256;
+
+// The answer to one background query.
+struct AsyncResult {
+  // positions of the chosen foods in increasing order, and their totals
+  IndexVector foods;
+  int kcal = 0;
+  int protein_g = 0;
+  // Whether the query was cancelled before it finished. A cancelled
+  // branch and bound query keeps the best foods it found, which fit
+  // the budget but may not be optimal; other cancelled queries have no
+  // foods.
+  bool cancelled = false;
+};
+
+// The priority a query with solver is queued at: the greedy solver is
+// fast, dp and branch and bound are usually quick, and the exhaustive
+// solvers may take seconds.
+TaskPriority solver_priority(Solver solver) {
+  switch (solver) {
+  case Solver::heap_greedy: return TaskPriority::high;
+  case Solver::dp: return TaskPriority::normal;
+  case Solver::branch_and_bound: return TaskPriority::normal;
+  default: return TaskPriority::low;
+  }
+}
+
+// Compute the same set of foods as gray_code_max_protein, calling stop
+// between runs of 2^16 subsets and giving up, leaving result empty, as
+// soon as it returns true. Returns whether the search finished.
+bool cancellable_gray_code_max_protein(IndexVector& result,
+				       const FoodTable& foods,
+				       int total_kcal,
+				       const std::function<bool()>& stop) {
+	INSTRUMENT_SCOPE(Phase::gray_code);
+	const int n = foods.size();
+	assert(n < 64);
+	result.clear();
+	const SubsetSumKernel kernel = subset_sum_kernel_for(n, best_subset_sum_kernel());
+	const int low_bits = subset_sum_low_bits(kernel);
+	const uint64_t ranks = uint64_t(1) << (n - low_bits);
+	const uint64_t chunk = uint64_t(1) << std::max(0, 16 - low_bits);
+	GrayCodeBest best;
+	for (uint64_t first = 0; first < ranks; first += chunk)
+	{
+		if (stop())
+			return false;
+		subset_sum_scan(best, foods.kcal_column(), foods.protein_g_column(), n,
+				first, std::min(first + chunk, ranks), total_kcal, kernel);
+	}
+	INSTRUMENT_COUNT(Counter::subsets_evaluated, uint64_t(1) << n);
+	indices_in_mask(result, best.mask);
+	return true;
+}
+
+// Solve as solve_max_protein does, giving up soon after cancel is
+// cancelled. The exhaustive and dp solvers check it between blocks of
+// subsets or foods, and branch and bound every 1024 nodes.
+// parallel_gray_code runs as gray_code on the calling thread, since the
+// pool already runs queries side by side. meet_in_middle and
+// heap_greedy only check it before they start.
+AsyncResult cancellable_max_protein(const FoodTable& foods,
+				    int total_kcal,
+				    Solver solver,
+				    const CancellationToken& cancel) {
+	AsyncResult result;
+	const std::function<bool()> stop = [&]() { return cancel.cancelled(); };
+	if (stop())
+	{
+		result.cancelled = true;
+		return result;
+	}
+	switch (solver)
+	{
+	case Solver::gray_code:
+	case Solver::parallel_gray_code:
+		result.cancelled = !cancellable_gray_code_max_protein(result.foods, foods, total_kcal, stop);
+		break;
+	case Solver::dp:
+		if (total_kcal >= 0)
+		{
+			ProteinCurve curve;
+			result.cancelled = !curve.solve(foods, total_kcal, &stop);
+			if (!result.cancelled)
+				curve.foods(result.foods, total_kcal);
+		}
+		break;
+	case Solver::branch_and_bound:
+		if (total_kcal >= 0)
+		{
+			BranchAndBoundWorkspace workspace;
+			prepare_branch_and_bound(workspace, foods, total_kcal);
+			BranchAndBoundStats stats;
+			const std::vector<bool>& chosen = workspace.search.run(workspace.kcal,
+									       workspace.protein,
+									       total_kcal,
+									       stats,
+									       nullptr,
+									       &stop);
+			for (size_t i = 0; i < chosen.size(); i++)
+			{
+				if (chosen[i])
+					result.foods.push_back(workspace.order[i]);
+			}
+			std::sort(result.foods.begin(), result.foods.end());
+			result.cancelled = workspace.search.stopped();
+		}
+		break;
+	default:
+		result.foods = solve_max_protein(foods, total_kcal, solver);
+		break;
+	}
+	sum_food_table(result.kcal, result.protein_g, foods, result.foods);
+	return result;
+}
+
+// The pool that solve_async uses by default: one worker per hardware
+// thread, with at most ASYNC_QUEUE_CAPACITY queries waiting.
+ThreadPool& shared_solver_pool() {
+  static ThreadPool pool(0, ASYNC_QUEUE_CAPACITY);
+  return pool;
+}
+
+// Queue a query on pool at solver_priority(solver), returning a future
+// for its answer. If pool's queue is full, wait until there is room.
+// foods is copied, which is cheap, and cancel, if non-null, is kept
+// alive until the query ends.
+std::future<AsyncResult> solve_async(ThreadPool& pool,
+				     const FoodTable& foods,
+				     int total_kcal,
+				     Solver solver,
+				     std::shared_ptr<const CancellationToken> cancel = nullptr) {
+  if (!cancel) {
+    cancel = std::make_shared<CancellationToken>();
+  }
+  return pool.submit([foods, total_kcal, solver, cancel]() {
+      return cancellable_max_protein(foods, total_kcal, solver, *cancel);
+    }, solver_priority(solver));
+}
+
+// Same as above, on the shared pool.
+std::future<AsyncResult> solve_async(const FoodTable& foods,
+				     int total_kcal,
+				     Solver solver,
+				     std::shared_ptr<const CancellationToken> cancel = nullptr) {
+  return solve_async(shared_solver_pool(), foods, total_kcal, solver, cancel);
+}
+
+// Same as solve_async, except that if pool's queue is full, return
+// false at once instead of waiting, so the caller can turn the request
+// away. Otherwise store the future in result and return true.
+bool try_solve_async(std::future<AsyncResult>& result,
+		     ThreadPool& pool,
+		     const FoodTable& foods,
+		     int total_kcal,
+		     Solver solver,
+		     std::shared_ptr<const CancellationToken> cancel = nullptr) {
+  if (!cancel) {
+    cancel = std::make_shared<CancellationToken>();
+  }
+  return pool.try_submit(result, [foods, total_kcal, solver, cancel]() {
+      return cancellable_max_protein(foods, total_kcal, solver, *cancel);
+    }, solver_priority(solver));
+}
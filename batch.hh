@@ -0,0 +1,141 @@
+///////////////////////////////////////////////////////////////////////////////
+// batch.hh
+//
+// Answer many max-protein queries over the same food table at once.
+//
+// Queries with the same kcal filter form a group. Each group filters
+// the table once with a FoodIndex and copies its foods into one
+// subtable, and all the dp queries in a group share a single
+// ProteinCurve built for the group's largest budget. Groups are solved
+// in parallel on a ThreadPool.
+//
+// How to use:
+//
+//    ThreadPool pool;
+//    std::vector<BatchQuery> queries = {
+//      {100, 500, 64, 2000, Solver::dp},
+//      {100, 500, 64, 1500, Solver::dp},  // shares the curve above
+//    };
+//    std::vector<BatchResult> results = batch_max_protein(*table, queries, pool);
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <future>
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include "maxprotein.hh"
+#include "threadpool.hh"
+
+// One query: the foods that filter_food_vector(source, min_kcal,
+// max_kcal, total_size) would choose, solved for total_kcal with the
+// given solver.
+struct BatchQuery {
+  int min_kcal;
+  int max_kcal;
+  int total_size;
+  int total_kcal;
+  Solver solver;
+};
+
+// The answer to one query. foods holds positions in the whole table,
+// as the solver returned them.
+struct BatchResult {
+  IndexVector foods;
+  int kcal = 0;
+  int protein_g = 0;
+};
+
+// Solve the queries of one group, whose foods are the positions in
+// filtered, storing each answer in results at the query's position.
+void batch_solve_group(std::vector<BatchResult>& results,
+		       const FoodTable& source,
+		       const IndexVector& filtered,
+		       const std::vector<BatchQuery>& queries,
+		       const std::vector<size_t>& members) {
+	FoodTable foods = source.subset(filtered);
+
+	// one curve answers every dp query, so build it for the largest
+	int max_dp_kcal = -1;
+	for (size_t q : members)
+	{
+		if (queries[q].solver == Solver::dp)
+			max_dp_kcal = std::max(max_dp_kcal, queries[q].total_kcal);
+	}
+	SolverContext context;
+	if (max_dp_kcal >= 0)
+		context.curve.solve(foods, max_dp_kcal);
+
+	// the other solvers reuse the context's memory from query to query,
+	// without touching the curve
+	IndexVector local;
+	for (size_t q : members)
+	{
+		const BatchQuery& query = queries[q];
+		if (query.solver == Solver::dp)
+		{
+			local.clear();
+			if (query.total_kcal >= 0)
+				context.curve.foods(local, query.total_kcal);
+		}
+		else
+			solve_max_protein(local, foods, query.total_kcal, query.solver, context);
+
+		BatchResult& result = results[q];
+		result.foods.clear();
+		result.foods.reserve(local.size());
+		for (size_t i : local)
+			result.foods.push_back(filtered[i]);
+		sum_food_table(result.kcal, result.protein_g, source, result.foods);
+	}
+}
+
+// Answer every query over source, returning the results in the same
+// order as queries. Equivalent to, but much faster than, filtering and
+// solving each query on its own.
+std::vector<BatchResult> batch_max_protein(const FoodTable& source,
+					   const std::vector<BatchQuery>& queries,
+					   ThreadPool& pool) {
+	std::vector<BatchResult> results(queries.size());
+
+	// group the queries by filter, in order of first appearance
+	typedef std::tuple<int, int, int> Filter;
+	std::map<Filter, size_t> group_of;
+	std::vector<std::vector<size_t>> groups;
+	for (size_t q = 0; q < queries.size(); q++)
+	{
+		Filter filter(queries[q].min_kcal, queries[q].max_kcal, queries[q].total_size);
+		auto it = group_of.find(filter);
+		if (it == group_of.end())
+		{
+			it = group_of.insert(std::make_pair(filter, groups.size())).first;
+			groups.push_back(std::vector<size_t>());
+		}
+		groups[it->second].push_back(q);
+	}
+	if (groups.empty())
+		return results;
+
+	const FoodIndex index(source);
+	// each group writes only its own queries' results
+	std::vector<std::future<void>> done;
+	for (const std::vector<size_t>& members : groups)
+	{
+		const BatchQuery& first = queries[members.front()];
+		done.push_back(pool.submit([&, members, first]() {
+			IndexVector filtered = index.filter(first.min_kcal, first.max_kcal, first.total_size);
+			batch_solve_group(results, source, filtered, queries, members);
+		}));
+	}
+	// wait for every group before get() can rethrow a failure, since
+	// the tasks refer to results
+	for (auto& group : done)
+		group.wait();
+	for (auto& group : done)
+		group.get();
+	return results;
+}
@@ -0,0 +1,66 @@
+///////////////////////////////////////////////////////////////////////////////
+// countingalloc.hh
+//
+// Replacements for the global operator new and operator delete that
+// count every allocation, so tests and benchmarks can check how often
+// code allocates.
+//
+// The replacements are definitions, so include this header in exactly
+// one source file of a program, the one with main().
+//
+// How to use:
+//
+//    const uint64_t before = allocation_count;
+//    solve();
+//    uint64_t allocations = allocation_count - before;
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// The replacements are not inlined, so the compiler sees each new
+// paired with its own delete rather than with malloc and free.
+#ifdef __GNUC__
+#define COUNTING_ALLOC_NOINLINE __attribute__((noinline))
+#else
+#define COUNTING_ALLOC_NOINLINE
+#endif
+
+// Number of calls to any operator new so far.
+std::atomic<uint64_t> allocation_count(0);
+
+COUNTING_ALLOC_NOINLINE void* operator new(size_t size) {
+  allocation_count++;
+  void* p = std::malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+COUNTING_ALLOC_NOINLINE void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+COUNTING_ALLOC_NOINLINE void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+COUNTING_ALLOC_NOINLINE void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+COUNTING_ALLOC_NOINLINE void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+COUNTING_ALLOC_NOINLINE void operator delete[](void* p, size_t) noexcept {
+  std::free(p);
+}
+#endif
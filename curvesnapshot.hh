@@ -0,0 +1,240 @@
+///////////////////////////////////////////////////////////////////////////////
+// curvesnapshot.hh
+//
+// Precomputed answers for one food table and every budget up to a
+// limit, saved to a file that can be memory-mapped, so that a process
+// answering queries against a fixed catalog does not solve the dp at
+// startup.
+//
+// A curve snapshot holds a fixed header, the greatest protein for each
+// budget from 0 through max_kcal (int32_t each), and the optimal set
+// of foods for each budget: max_kcal + 2 offsets (uint32_t each) into
+// a final array of food positions (uint32_t each), so the foods for
+// budget c are positions[offsets[c]] .. positions[offsets[c + 1] - 1].
+// Storing each set outright takes one position per chosen food per
+// budget, which for plans of a few foods out of thousands is less
+// space than the dp's take bits, one bit per food of the table per
+// budget, and a query copies its k foods in O(k) time instead of
+// walking all n. Numbers are in native byte order, as in snapshot.hh.
+// The header records food_table_hash of the table the curve was
+// solved for, so a curve is never used with other foods.
+//
+// How to use:
+//
+//    // offline
+//    write_curve_snapshot(catalog, 5000, "ABBREV.curve");
+//    // online
+//    auto curve = load_curve_snapshot("ABBREV.curve", catalog);
+//    if (curve && 2000 <= curve->max_kcal()) {
+//      IndexVector plan = curve->foods(2000);
+//    }
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mappedfile.hh"
+#include "maxprotein.hh"
+#include "snapshot.hh"
+
+// The first bytes of every curve snapshot file.
+struct CurveSnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  // Always 0x01020304 in the byte order of the writer.
+  uint32_t byte_order;
+  uint64_t food_count;
+  uint64_t max_kcal;
+  // food_table_hash of the table the curve was solved for.
+  uint64_t table_hash;
+  // Length of the positions array.
+  uint64_t position_count;
+  // FNV-1a hash of every byte after the header.
+  uint64_t checksum;
+};
+
+const char CURVE_SNAPSHOT_MAGIC[8] = {'M', 'A', 'X', 'C', 'U', 'R', 'V', '\0'};
+const uint32_t CURVE_SNAPSHOT_VERSION = 1;
+
+// The answers stored in a curve snapshot, read straight from its
+// memory mapping.
+class CurveSnapshot {
+public:
+  CurveSnapshot(size_t max_kcal,
+		const int32_t* best,
+		const uint32_t* offsets,
+		const uint32_t* positions,
+		std::shared_ptr<const void> storage)
+    : _max_kcal(max_kcal),
+      _best(best),
+      _offsets(offsets),
+      _positions(positions),
+      _storage(storage) { }
+
+  int max_kcal() const { return _max_kcal; }
+
+  // Greatest protein achievable within total_kcal, in O(1) time.
+  int protein_g(int total_kcal) const {
+    assert(total_kcal >= 0 && total_kcal <= max_kcal());
+    return _best[total_kcal];
+  }
+
+  // Number of foods in the optimal set for total_kcal.
+  size_t food_count(int total_kcal) const {
+    assert(total_kcal >= 0 && total_kcal <= max_kcal());
+    return _offsets[total_kcal + 1] - _offsets[total_kcal];
+  }
+
+  // The optimal set of foods within total_kcal that ProteinCurve
+  // reconstructs, in O(k) time for k foods. Returns their positions in
+  // increasing order.
+  IndexVector foods(int total_kcal) const {
+    IndexVector result;
+    foods(result, total_kcal);
+    return result;
+  }
+
+  // Same as above, storing the positions in result and reusing its
+  // memory.
+  void foods(IndexVector& result, int total_kcal) const {
+    assert(total_kcal >= 0 && total_kcal <= max_kcal());
+    result.assign(_positions + _offsets[total_kcal], _positions + _offsets[total_kcal + 1]);
+  }
+
+private:
+  size_t _max_kcal;
+  const int32_t* _best;
+  const uint32_t* _offsets;
+  const uint32_t* _positions;
+  std::shared_ptr<const void> _storage;
+};
+
+// Solve foods for every budget from 0 through max_kcal, which must be
+// non-negative, and write the answers to a curve snapshot at path.
+// Takes the time of one ProteinCurve, plus O(n) per budget to
+// reconstruct the sets. Returns false on I/O error.
+bool write_curve_snapshot(const FoodTable& foods,
+			  int max_kcal,
+			  const std::string& path) {
+  assert(max_kcal >= 0);
+  const ProteinCurve curve(foods, max_kcal);
+  std::vector<uint32_t> offsets, positions;
+  offsets.reserve(size_t(max_kcal) + 2);
+  offsets.push_back(0);
+  IndexVector chosen;
+  for (int c = 0; c <= max_kcal; c++) {
+    curve.foods(chosen, c);
+    positions.insert(positions.end(), chosen.begin(), chosen.end());
+    offsets.push_back(positions.size());
+  }
+
+  CurveSnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, CURVE_SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = CURVE_SNAPSHOT_VERSION;
+  header.byte_order = SNAPSHOT_BYTE_ORDER;
+  header.food_count = foods.size();
+  header.max_kcal = max_kcal;
+  header.table_hash = food_table_hash(foods);
+  header.position_count = positions.size();
+
+  const std::vector<int>& best = curve.curve();
+  const size_t best_bytes = best.size() * sizeof(int32_t);
+  uint64_t hash = fnv1a_hash(best.data(), best_bytes);
+  hash = fnv1a_hash(offsets.data(), offsets.size() * sizeof(uint32_t), hash);
+  hash = fnv1a_hash(positions.data(), positions.size() * sizeof(uint32_t), hash);
+  header.checksum = hash;
+
+  std::ofstream f(path, std::ios::binary | std::ios::trunc);
+  if (!f) {
+    return false;
+  }
+  f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  f.write(reinterpret_cast<const char*>(best.data()), best_bytes);
+  f.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint32_t));
+  f.write(reinterpret_cast<const char*>(positions.data()), positions.size() * sizeof(uint32_t));
+  f.close();
+  return bool(f);
+}
+
+// Map the curve snapshot at path, which must have been written for
+// foods, and whose arrays are then used in place. The whole file is
+// checksummed, but nothing is copied. Returns nullptr if the snapshot
+// cannot be used, and if status is non-null, stores why: stale means
+// it was written for other foods.
+std::unique_ptr<CurveSnapshot> load_curve_snapshot(const std::string& path,
+						   const FoodTable& foods,
+						   SnapshotStatus* status = nullptr) {
+  SnapshotStatus local_status;
+  if (status == nullptr) {
+    status = &local_status;
+  }
+  std::unique_ptr<CurveSnapshot> failure(nullptr);
+
+  std::shared_ptr<MappedFile> file(new MappedFile);
+  if (!file->open(path)) {
+    *status = SnapshotStatus::missing;
+    return failure;
+  }
+
+  CurveSnapshotHeader header;
+  *status = SnapshotStatus::corrupt;
+  if (file->size() < sizeof(header)) {
+    return failure;
+  }
+  std::memcpy(&header, file->data(), sizeof(header));
+  if ((std::memcmp(header.magic, CURVE_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) ||
+      (header.version != CURVE_SNAPSHOT_VERSION) ||
+      (header.byte_order != SNAPSHOT_BYTE_ORDER)) {
+    return failure;
+  }
+  const uint64_t budgets = header.max_kcal + 1;
+  if ((budgets > file->size()) || (header.position_count > file->size()) ||
+      (file->size() - sizeof(header) !=
+       (2 * budgets + 1 + header.position_count) * sizeof(uint32_t))) {
+    return failure;
+  }
+  const char* body = file->data() + sizeof(header);
+  if (fnv1a_hash(body, file->size() - sizeof(header)) != header.checksum) {
+    return failure;
+  }
+
+  if ((header.food_count != foods.size()) || (header.table_hash != food_table_hash(foods))) {
+    *status = SnapshotStatus::stale;
+    return failure;
+  }
+
+  const int32_t* best = reinterpret_cast<const int32_t*>(body);
+  const uint32_t* offsets = reinterpret_cast<const uint32_t*>(best + budgets);
+  const uint32_t* positions = offsets + budgets + 1;
+
+  // a file with a good checksum may still have been written wrongly;
+  // every set must lie within the positions and name foods of the table
+  *status = SnapshotStatus::corrupt;
+  if (offsets[0] != 0 || offsets[budgets] != header.position_count) {
+    return failure;
+  }
+  for (uint64_t c = 0; c < budgets; c++) {
+    if (offsets[c] > offsets[c + 1]) {
+      return failure;
+    }
+  }
+  for (uint64_t i = 0; i < header.position_count; i++) {
+    if (positions[i] >= foods.size()) {
+      return failure;
+    }
+  }
+  *status = SnapshotStatus::ok;
+  return std::unique_ptr<CurveSnapshot>(new CurveSnapshot(header.max_kcal,
+							  best,
+							  offsets,
+							  positions,
+							  file));
+}
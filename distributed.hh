@@ -0,0 +1,1105 @@
+///////////////////////////////////////////////////////////////////////////////
+// distributed.hh
+//
+// Exhaustive and branch and bound searches split across worker
+// processes, which may run on other machines, with checkpoints so a
+// long job survives the loss of a worker or of the coordinator.
+//
+// The subsets are split into units. An exhaustive unit is a prefix of
+// the bitmask: the subsets whose high foods are fixed, the low
+// unit_bits foods varying, scanned with the same subset_sum_scan and
+// GrayCodeBest as gray_code_max_protein. A branch and bound unit is one
+// subtree at the frontier of depth unit_bits of the density-ordered
+// search tree of branch_and_bound_max_protein: whether each of the
+// first unit_bits foods is in or out. The coordinator, a
+// DistributedSearch, hands out units and keeps the incumbent, the best
+// set any unit has found. Workers are given the incumbent with each
+// unit and are sent every improvement while they work, so every worker
+// prunes with the global bound: branch and bound subtrees, and whole
+// exhaustive units whose fractional bound is below it.
+//
+// Workers are separate processes started with /bin/sh -c, so a worker
+// command may be "ssh node7 maxprotein_distributed worker", speaking a
+// line protocol on their standard input and output. A worker whose
+// connection closes has its units handed to the others. The
+// coordinator checkpoints which units are done and the incumbent, so
+// a job can be resumed from its last checkpoint.
+//
+// How to use:
+//
+//    DistributedSearch search(table, 2000, DistributedKind::exhaustive);
+//    search.resume("job.checkpoint");  // if there is one
+//    run_distributed_search(search, {"ssh a maxprotein_distributed worker",
+//                                    "ssh b maxprotein_distributed worker"},
+//                           "job.checkpoint");
+//    if (search.finished()) {
+//      IndexVector plan = search.foods();
+//    }
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "maxprotein.hh"
+#include "snapshot.hh"
+
+// How the subsets of a distributed search are split into units.
+enum class DistributedKind {
+  exhaustive,
+  branch_and_bound
+};
+
+// Default low foods varied within one exhaustive unit, 2^24 subsets,
+// which takes a few milliseconds on one core.
+const int DISTRIBUTED_EXHAUSTIVE_UNIT_BITS = 24;
+
+// Default depth of the branch and bound frontier, 4096 subtrees.
+const int DISTRIBUTED_FRONTIER_DEPTH = 12;
+
+// A search has at most 2^DISTRIBUTED_MAX_UNITS_LOG2 units, so the
+// coordinator's record of which are done stays small.
+const int DISTRIBUTED_MAX_UNITS_LOG2 = 28;
+
+// Exhaustive units vary at least this many foods, the widest
+// subset-sum kernel's block, so every kernel scans whole units.
+const int DISTRIBUTED_MIN_UNIT_BITS = 4;
+
+// Units each worker is given at a time, so it has the next one at
+// hand when it finishes one.
+const size_t DISTRIBUTED_UNITS_IN_FLIGHT = 2;
+
+// Most foods a job or a result may hold on the wire.
+const size_t DISTRIBUTED_MAX_FOODS = size_t(1) << 20;
+
+// Milliseconds a worker process is given to exit before it is killed.
+const int DISTRIBUTED_STOP_MILLISECONDS = 1000;
+
+// Default seconds between checkpoints.
+const int DISTRIBUTED_CHECKPOINT_SECONDS = 10;
+
+// Everything a worker needs to search any unit of a job: the kcal and
+// protein of its foods, which for branch and bound are in density
+// order.
+struct DistributedJob {
+  DistributedKind kind = DistributedKind::exhaustive;
+  int total_kcal = 0;
+  // low foods of an exhaustive unit, or depth of the frontier
+  int unit_bits = 0;
+  std::vector<int32_t> kcal, protein;
+
+  uint64_t unit_count() const {
+    const int fixed = (kind == DistributedKind::exhaustive) ? int(kcal.size()) - unit_bits : unit_bits;
+    return uint64_t(1) << fixed;
+  }
+};
+
+// What a worker found in one unit: the best subset in it with more
+// protein than the incumbent it was given, or for an exhaustive unit
+// the best subset in it unless all have less. protein_g is -1 if there
+// is no such subset.
+struct DistributedUnitResult {
+  uint64_t unit = 0;
+  int protein_g = -1;
+  // positions in the job's foods, in increasing order
+  std::vector<uint32_t> foods;
+  // subsets scanned or search nodes visited
+  uint64_t work = 0;
+};
+
+// The protocol between coordinator and workers is one message per
+// line. The coordinator sends
+//
+//    job KIND TOTAL_KCAL UNIT_BITS N KCAL_0 PROTEIN_0 ... KCAL_N-1 PROTEIN_N-1
+//    unit UNIT INCUMBENT
+//    bound INCUMBENT
+//    quit
+//
+// and a worker answers each unit with
+//
+//    done UNIT PROTEIN WORK COUNT FOOD_0 ... FOOD_COUNT-1
+
+std::string distributed_job_message(const DistributedJob& job) {
+  std::ostringstream out;
+  out << "job " << int(job.kind) << ' ' << job.total_kcal << ' ' << job.unit_bits
+      << ' ' << job.kcal.size();
+  for (size_t i = 0; i < job.kcal.size(); i++) {
+    out << ' ' << job.kcal[i] << ' ' << job.protein[i];
+  }
+  return out.str();
+}
+
+// Parse the words after "job". Returns false if they are malformed.
+bool parse_distributed_job(DistributedJob& job, std::istream& words) {
+  int kind;
+  size_t n;
+  if (!(words >> kind >> job.total_kcal >> job.unit_bits >> n) ||
+      (kind != int(DistributedKind::exhaustive) && kind != int(DistributedKind::branch_and_bound))) {
+    return false;
+  }
+  job.kind = DistributedKind(kind);
+  if (n > DISTRIBUTED_MAX_FOODS) {
+    return false;
+  }
+  // grow with the foods actually read, not the count claimed
+  job.kcal.clear();
+  job.protein.clear();
+  for (size_t i = 0; i < n; i++) {
+    int32_t kcal, protein;
+    if (!(words >> kcal >> protein) || kcal < 0) {
+      return false;
+    }
+    job.kcal.push_back(kcal);
+    job.protein.push_back(protein);
+  }
+  if (job.kind == DistributedKind::exhaustive) {
+    return (n < 64) && (job.unit_bits <= int(n)) &&
+      (job.unit_bits >= std::min<int>(n, DISTRIBUTED_MIN_UNIT_BITS));
+  }
+  return (job.unit_bits >= 0) && (job.unit_bits <= int(n)) &&
+    (job.unit_bits <= DISTRIBUTED_MAX_UNITS_LOG2);
+}
+
+std::string distributed_result_message(const DistributedUnitResult& result) {
+  std::ostringstream out;
+  out << "done " << result.unit << ' ' << result.protein_g << ' ' << result.work
+      << ' ' << result.foods.size();
+  for (uint32_t food : result.foods) {
+    out << ' ' << food;
+  }
+  return out.str();
+}
+
+// Parse the words after "done". Returns false if they are malformed.
+bool parse_distributed_result(DistributedUnitResult& result, std::istream& words) {
+  size_t count;
+  if (!(words >> result.unit >> result.protein_g >> result.work >> count)) {
+    return false;
+  }
+  if (count > DISTRIBUTED_MAX_FOODS) {
+    return false;
+  }
+  result.foods.clear();
+  for (size_t i = 0; i < count; i++) {
+    uint32_t food;
+    if (!(words >> food)) {
+      return false;
+    }
+    result.foods.push_back(food);
+  }
+  return true;
+}
+
+// Search one unit of job, looking for subsets with more protein than
+// incumbent, which is -1 if nothing is known yet. If incumbent_now is
+// non-null, a branch and bound unit calls it every 1024 nodes for the
+// current incumbent, which may have risen since the unit began, and
+// prunes with that.
+DistributedUnitResult run_distributed_unit(const DistributedJob& job,
+					   uint64_t unit,
+					   int incumbent,
+					   const std::function<int()>* incumbent_now = nullptr) {
+	assert(unit < job.unit_count());
+	DistributedUnitResult result;
+	result.unit = unit;
+	const int n = job.kcal.size(), bits = job.unit_bits;
+	const int32_t* kcal = job.kcal.data();
+	const int32_t* protein = job.protein.data();
+
+	if (job.kind == DistributedKind::exhaustive)
+	{
+		// the high foods of every subset of the unit
+		const uint64_t high = (unit ^ (unit >> 1)) << bits;
+		int64_t prefix_kcal = 0, prefix_protein = 0;
+		for (int j = bits; j < n; j++)
+		{
+			if ((high >> j) & 1)
+			{
+				prefix_kcal += kcal[j];
+				prefix_protein += protein[j];
+			}
+		}
+		if (prefix_kcal > job.total_kcal)
+			return result;
+
+		// skip the unit if even a fraction of the low foods cannot
+		// reach the incumbent; ties must still be scanned, since the
+		// smallest mask wins them
+		if (incumbent >= 0)
+		{
+			std::vector<int> low(bits);
+			for (int j = 0; j < bits; j++)
+				low[j] = j;
+			std::sort(low.begin(), low.end(),
+				  [&](int a, int b) {
+					  return int64_t(protein[a]) * kcal[b] > int64_t(protein[b]) * kcal[a];
+				  });
+			int64_t capacity = job.total_kcal - prefix_kcal, bound = prefix_protein;
+			for (int j : low)
+			{
+				if (protein[j] <= 0)
+					continue;
+				if (kcal[j] <= capacity)
+				{
+					capacity -= kcal[j];
+					bound += protein[j];
+				}
+				else
+				{
+					bound += (capacity * protein[j]) / kcal[j];
+					break;
+				}
+			}
+			if (bound < incumbent)
+				return result;
+		}
+
+		const SubsetSumKernel kernel = subset_sum_kernel_for(n, best_subset_sum_kernel());
+		const int low_bits = subset_sum_low_bits(kernel);
+		GrayCodeBest best;
+		subset_sum_scan(best, kcal, protein, n, (unit << bits) >> low_bits,
+				((unit + 1) << bits) >> low_bits, job.total_kcal, kernel);
+		result.work = uint64_t(1) << bits;
+		if (best.protein_g >= 0)
+		{
+			result.protein_g = best.protein_g;
+			for (int j = 0; j < n; j++)
+			{
+				if ((best.mask >> j) & 1)
+					result.foods.push_back(j);
+			}
+		}
+		return result;
+	}
+
+	// bit j of the unit set means food j is left out, so unit 0, the
+	// densest subtree, is searched first
+	int prefix_kcal = 0, prefix_protein = 0;
+	for (int j = 0; j < bits; j++)
+	{
+		if (!((unit >> j) & 1))
+		{
+			prefix_kcal += kcal[j];
+			prefix_protein += protein[j];
+		}
+	}
+	if (prefix_kcal > job.total_kcal)
+		return result;
+
+	const std::vector<int> suffix_kcal(job.kcal.begin() + bits, job.kcal.end()),
+		suffix_protein(job.protein.begin() + bits, job.protein.end());
+	// the suffix must have more protein than floor to beat incumbent;
+	// if floor is negative, the prefix alone beats it
+	int floor = incumbent - prefix_protein;
+	BranchAndBoundSearch search;
+	BranchAndBoundStats stats;
+	const std::function<bool()> stop = [&]() {
+		const int now = (*incumbent_now)() - prefix_protein;
+		if (now > floor)
+		{
+			floor = now;
+			search.raise_bound(now);
+		}
+		return false;
+	};
+	const std::vector<bool>& chosen = search.run(suffix_kcal,
+						     suffix_protein,
+						     job.total_kcal - prefix_kcal,
+						     stats,
+						     nullptr,
+						     (incumbent_now != nullptr) ? &stop : nullptr,
+						     std::max(0, floor));
+	result.work = stats.nodes;
+	if (search.best_protein() > floor)
+	{
+		result.protein_g = prefix_protein + search.best_protein();
+		for (int j = 0; j < int(chosen.size()) + bits; j++)
+		{
+			if ((j < bits) ? !((unit >> j) & 1) : chosen[j - bits])
+				result.foods.push_back(j);
+		}
+	}
+	return result;
+}
+
+// The first bytes of every checkpoint file.
+struct DistributedCheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  // Always 0x01020304 in the byte order of the writer.
+  uint32_t byte_order;
+  // DistributedSearch::job_hash() of the job.
+  uint64_t job_hash;
+  uint64_t unit_count;
+  int64_t best_protein;
+  // Length of the incumbent's positions array.
+  uint64_t best_count;
+  // FNV-1a hash of every byte after the header.
+  uint64_t checksum;
+};
+
+const char DISTRIBUTED_CHECKPOINT_MAGIC[8] = {'M', 'A', 'X', 'D', 'I', 'S', 'T', '\0'};
+const uint32_t DISTRIBUTED_CHECKPOINT_VERSION = 1;
+
+// The coordinator of a distributed search: which units are done, which
+// are left to hand out, and the incumbent.
+//
+// Units are handed out in increasing order, except that units given
+// back with abandon() are handed out again first. A unit may be handed
+// out more than once, if its worker was given up on but did finish
+// it; every result but the first is ignored.
+class DistributedSearch {
+public:
+  // Prepare to search the subsets of foods within total_kcal. For
+  // exhaustive, foods must number less than 64. unit_bits is the number
+  // of low foods varied in an exhaustive unit, or the depth of the
+  // branch and bound frontier, raised or lowered so that there are at
+  // most 2^DISTRIBUTED_MAX_UNITS_LOG2 units; if it is negative, a
+  // default is used. The incumbent starts as the greedy set of the
+  // densest foods that fit.
+  DistributedSearch(const FoodTable& foods,
+		    int total_kcal,
+		    DistributedKind kind,
+		    int unit_bits = -1)
+    : _next(0),
+      _done_count(0),
+      _best_protein(-1),
+      _best_mask(0) {
+    assert(total_kcal >= 0);
+    _job.kind = kind;
+    _job.total_kcal = total_kcal;
+    IndexVector density_order;
+    if (kind == DistributedKind::exhaustive) {
+      const int n = foods.size();
+      assert(n < 64);
+      _job.kcal.assign(foods.kcal_column(), foods.kcal_column() + n);
+      _job.protein.assign(foods.protein_g_column(), foods.protein_g_column() + n);
+      for (int i = 0; i < n; i++) {
+	_order.push_back(i);
+	density_order.push_back(i);
+      }
+      std::sort(density_order.begin(), density_order.end(), [&](size_t a, size_t b) {
+	  return int64_t(_job.protein[a]) * _job.kcal[b] > int64_t(_job.protein[b]) * _job.kcal[a];
+	});
+      if (unit_bits < 0) {
+	unit_bits = DISTRIBUTED_EXHAUSTIVE_UNIT_BITS;
+      }
+      unit_bits = std::max(unit_bits, n - DISTRIBUTED_MAX_UNITS_LOG2);
+      _job.unit_bits = std::min(std::max(unit_bits, DISTRIBUTED_MIN_UNIT_BITS), n);
+    } else {
+      BranchAndBoundWorkspace workspace;
+      prepare_branch_and_bound(workspace, foods, total_kcal);
+      _order = workspace.order;
+      _job.kcal.assign(workspace.kcal.begin(), workspace.kcal.end());
+      _job.protein.assign(workspace.protein.begin(), workspace.protein.end());
+      for (size_t i = 0; i < _order.size(); i++) {
+	density_order.push_back(i);
+      }
+      if (unit_bits < 0) {
+	unit_bits = DISTRIBUTED_FRONTIER_DEPTH;
+      }
+      _job.unit_bits = std::min<int>(std::min(unit_bits, DISTRIBUTED_MAX_UNITS_LOG2), _order.size());
+    }
+    _done.assign(_job.unit_count(), false);
+
+    // hash the problem, so a checkpoint is never resumed for another
+    _job_hash = food_table_hash(foods);
+    const int32_t settings[3] = {int32_t(kind), total_kcal, _job.unit_bits};
+    _job_hash = fnv1a_hash(settings, sizeof(settings), _job_hash);
+
+    DistributedUnitResult greedy;
+    int kcal = 0;
+    greedy.protein_g = 0;
+    for (size_t i : density_order) {
+      if (_job.protein[i] > 0 && kcal + _job.kcal[i] <= total_kcal) {
+	kcal += _job.kcal[i];
+	greedy.protein_g += _job.protein[i];
+	greedy.foods.push_back(i);
+      }
+    }
+    std::sort(greedy.foods.begin(), greedy.foods.end());
+    offer(greedy);
+  }
+
+  // What workers are sent.
+  const DistributedJob& job() const { return _job; }
+
+  // Identifies the foods, budget, kind and units of this search.
+  uint64_t job_hash() const { return _job_hash; }
+
+  uint64_t unit_count() const { return _done.size(); }
+  uint64_t units_done() const { return _done_count; }
+  bool unit_done(uint64_t unit) const { return _done[unit]; }
+  bool finished() const { return _done_count == _done.size(); }
+
+  // Protein of the best set found so far.
+  int incumbent_protein() const { return _best_protein; }
+
+  // The best set of foods found so far; once finished(), the same
+  // protein as branch_and_bound_max_protein finds, and for exhaustive
+  // the same foods as gray_code_max_protein. Returns their positions in
+  // the table in increasing order.
+  IndexVector foods() const {
+    IndexVector result;
+    for (uint32_t i : _best) {
+      result.push_back(_order[i]);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  // Store in unit the next unit to search and return true, or return
+  // false if every unit is done or handed out.
+  bool next_unit(uint64_t& unit) {
+    while (!_retry.empty()) {
+      unit = _retry.front();
+      _retry.pop_front();
+      if (!_done[unit]) {
+	return true;
+      }
+    }
+    while (_next < _done.size() && _done[_next]) {
+      _next++;
+    }
+    if (_next == _done.size()) {
+      return false;
+    }
+    unit = _next++;
+    return true;
+  }
+
+  // Whether result could be a true answer for its unit: the unit
+  // exists, the foods are distinct positions of the job in increasing
+  // order that fit the budget and have the protein claimed, and they
+  // agree with the foods the unit fixes. A result from a worker is
+  // untrusted until this says so.
+  bool valid_result(const DistributedUnitResult& result) const {
+    if (result.unit >= _done.size() || result.protein_g < -1) {
+      return false;
+    }
+    if (result.protein_g == -1) {
+      return result.foods.empty();
+    }
+    if (!consistent(result.foods, result.protein_g)) {
+      return false;
+    }
+    const int bits = _job.unit_bits;
+    if (_job.kind == DistributedKind::exhaustive) {
+      uint64_t high = 0;
+      for (uint32_t i : result.foods) {
+	if (int(i) >= bits) {
+	  high |= uint64_t(1) << (i - bits);
+	}
+      }
+      return high == (result.unit ^ (result.unit >> 1));
+    }
+    uint64_t excluded = (uint64_t(1) << bits) - 1;
+    for (uint32_t i : result.foods) {
+      if (int(i) < bits) {
+	excluded &= ~(uint64_t(1) << i);
+      }
+    }
+    return excluded == result.unit;
+  }
+
+  // Record a worker's result, unless it is not valid_result(). Returns
+  // whether the incumbent improved.
+  bool complete(const DistributedUnitResult& result) {
+    if (!valid_result(result) || _done[result.unit]) {
+      return false;
+    }
+    _done[result.unit] = true;
+    _done_count++;
+    return offer(result);
+  }
+
+  // Give back a unit whose worker was lost, to be handed out again.
+  void abandon(uint64_t unit) {
+    assert(unit < _done.size());
+    if (!_done[unit]) {
+      _retry.push_back(unit);
+    }
+  }
+
+  // Write which units are done and the incumbent to path. The new
+  // checkpoint is written to path + ".tmp" and flushed to disk before
+  // it is renamed over path, and the directory is then flushed too, so
+  // a crash of the process or of the machine leaves the old checkpoint
+  // or the new one. Returns false on I/O error.
+  bool save_checkpoint(const std::string& path) const {
+    std::vector<uint8_t> done((_done.size() + 7) / 8, 0);
+    for (size_t i = 0; i < _done.size(); i++) {
+      if (_done[i]) {
+	done[i / 8] |= uint8_t(1) << (i % 8);
+      }
+    }
+
+    DistributedCheckpointHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, DISTRIBUTED_CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = DISTRIBUTED_CHECKPOINT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.job_hash = _job_hash;
+    header.unit_count = _done.size();
+    header.best_protein = _best_protein;
+    header.best_count = _best.size();
+    const size_t best_bytes = _best.size() * sizeof(uint32_t);
+    header.checksum = fnv1a_hash(_best.data(), best_bytes, fnv1a_hash(done.data(), done.size()));
+
+    std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+    data.append(reinterpret_cast<const char*>(done.data()), done.size());
+    data.append(reinterpret_cast<const char*>(_best.data()), best_bytes);
+
+    const std::string temporary = path + ".tmp";
+    const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    bool ok = true;
+    for (size_t written = 0; ok && written < data.size(); ) {
+      const ssize_t count = ::write(fd, data.data() + written, data.size() - written);
+      if (count < 0 && errno == EINTR) {
+	continue;
+      }
+      ok = (count > 0);
+      if (ok) {
+	written += count;
+      }
+    }
+    ok = ok && (::fsync(fd) == 0);
+    ok = (::close(fd) == 0) && ok;
+    if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+      std::remove(temporary.c_str());
+      return false;
+    }
+
+    // flush the rename itself
+    const size_t slash = path.rfind('/');
+    const std::string directory =
+      (slash == std::string::npos) ? "." : (slash == 0) ? "/" : path.substr(0, slash);
+    const int directory_fd = ::open(directory.c_str(), O_RDONLY);
+    if (directory_fd < 0) {
+      return false;
+    }
+    ok = (::fsync(directory_fd) == 0);
+    ::close(directory_fd);
+    return ok;
+  }
+
+  // Continue from the checkpoint at path, which must have been saved
+  // by a search of the same job: mark its units done and take its
+  // incumbent if that is better. Units handed out since are handed out
+  // again. Returns false, changing nothing, if the checkpoint cannot be
+  // used, and if status is non-null, stores why: stale means it is of
+  // another job.
+  bool resume(const std::string& path, SnapshotStatus* status = nullptr) {
+    SnapshotStatus local_status;
+    if (status == nullptr) {
+      status = &local_status;
+    }
+    std::ifstream f(path, std::ios::binary);
+    if (!f) {
+      *status = SnapshotStatus::missing;
+      return false;
+    }
+    const std::string contents((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+    DistributedCheckpointHeader header;
+    *status = SnapshotStatus::corrupt;
+    if (contents.size() < sizeof(header)) {
+      return false;
+    }
+    std::memcpy(&header, contents.data(), sizeof(header));
+    if ((std::memcmp(header.magic, DISTRIBUTED_CHECKPOINT_MAGIC, sizeof(header.magic)) != 0) ||
+	(header.version != DISTRIBUTED_CHECKPOINT_VERSION) ||
+	(header.byte_order != SNAPSHOT_BYTE_ORDER)) {
+      return false;
+    }
+    const uint64_t done_bytes = (header.unit_count + 7) / 8;
+    const uint64_t body_size = contents.size() - sizeof(header);
+    if ((header.unit_count > 8 * body_size) || (header.best_count > body_size) ||
+	(body_size != done_bytes + header.best_count * sizeof(uint32_t))) {
+      return false;
+    }
+    const char* body = contents.data() + sizeof(header);
+    if (fnv1a_hash(body, body_size) != header.checksum) {
+      return false;
+    }
+
+    if ((header.job_hash != _job_hash) || (header.unit_count != _done.size())) {
+      *status = SnapshotStatus::stale;
+      return false;
+    }
+    DistributedUnitResult saved;
+    saved.protein_g = header.best_protein;
+    saved.foods.resize(header.best_count);
+    std::memcpy(saved.foods.data(), body + done_bytes, header.best_count * sizeof(uint32_t));
+    if (header.best_protein < 0 || header.best_protein > INT_MAX ||
+	!consistent(saved.foods, header.best_protein)) {
+      return false;
+    }
+
+    for (size_t i = 0; i < _done.size(); i++) {
+      if (((body[i / 8] >> (i % 8)) & 1) && !_done[i]) {
+	_done[i] = true;
+	_done_count++;
+      }
+    }
+    offer(saved);
+    _next = 0;
+    _retry.clear();
+    *status = SnapshotStatus::ok;
+    return true;
+  }
+
+private:
+  // Whether foods are distinct positions of the job in increasing
+  // order, within the budget and with protein_g protein in all.
+  bool consistent(const std::vector<uint32_t>& foods, int64_t protein_g) const {
+    int64_t kcal = 0, protein = 0;
+    for (size_t k = 0; k < foods.size(); k++) {
+      if (foods[k] >= _job.kcal.size() || (k > 0 && foods[k] <= foods[k - 1])) {
+	return false;
+      }
+      kcal += _job.kcal[foods[k]];
+      protein += _job.protein[foods[k]];
+    }
+    return kcal <= _job.total_kcal && protein == protein_g;
+  }
+
+  // Take the foods of result as the incumbent if they are better.
+  bool offer(const DistributedUnitResult& result) {
+    if (result.protein_g < 0) {
+      return false;
+    }
+    if (_job.kind == DistributedKind::exhaustive) {
+      uint64_t mask = 0;
+      for (uint32_t i : result.foods) {
+	mask |= uint64_t(1) << i;
+      }
+      if (result.protein_g < _best_protein ||
+	  (result.protein_g == _best_protein && mask >= _best_mask)) {
+	return false;
+      }
+      _best_mask = mask;
+    } else if (result.protein_g <= _best_protein) {
+      return false;
+    }
+    _best_protein = result.protein_g;
+    _best = result.foods;
+    return true;
+  }
+
+  DistributedJob _job;
+  // position in the table of each of the job's foods
+  IndexVector _order;
+  uint64_t _job_hash;
+  std::vector<bool> _done;
+  // units never handed out are _next onwards
+  uint64_t _next;
+  std::deque<uint64_t> _retry;
+  uint64_t _done_count;
+  int _best_protein;
+  uint64_t _best_mask;
+  std::vector<uint32_t> _best;
+};
+
+// One end of a connection that carries lines of text.
+class LineChannel {
+public:
+  explicit LineChannel(int fd = -1) : _fd(fd) { }
+
+  int fd() const { return _fd; }
+
+  // Send line and a newline, waiting until all is written. Returns
+  // false if the other end has gone. A socket whose peer has gone
+  // does not raise SIGPIPE.
+  bool send_line(const std::string& line) {
+    const std::string data = line + '\n';
+    size_t sent = 0;
+    while (sent < data.size()) {
+      ssize_t count = ::send(_fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      if (count < 0 && errno == ENOTSOCK) {
+	count = ::write(_fd, data.data() + sent, data.size() - sent);
+      }
+      if (count < 0 && errno == EINTR) {
+	continue;
+      }
+      if (count <= 0) {
+	return false;
+      }
+      sent += count;
+    }
+    return true;
+  }
+
+  // Whether data or end of file can be read within timeout_ms
+  // milliseconds, which may be 0, or -1 to wait for ever.
+  bool readable(int timeout_ms) const {
+    struct pollfd ready;
+    ready.fd = _fd;
+    ready.events = POLLIN;
+    ready.revents = 0;
+    int count;
+    do {
+      count = ::poll(&ready, 1, timeout_ms);
+    } while (count < 0 && errno == EINTR);
+    return count != 0;
+  }
+
+  // Read what is available, waiting for some if there is none. Returns
+  // false at end of file or on error.
+  bool fill() {
+    char data[65536];
+    ssize_t count;
+    do {
+      count = ::read(_fd, data, sizeof(data));
+    } while (count < 0 && errno == EINTR);
+    if (count <= 0) {
+      return false;
+    }
+    _buffer.append(data, count);
+    return true;
+  }
+
+  // Store in line the next whole line read, without its newline, and
+  // return true, or return false if there is none yet.
+  bool next_line(std::string& line) {
+    const size_t end = _buffer.find('\n');
+    if (end == std::string::npos) {
+      return false;
+    }
+    line.assign(_buffer, 0, end);
+    _buffer.erase(0, end + 1);
+    return true;
+  }
+
+private:
+  int _fd;
+  std::string _buffer;
+};
+
+// Serve a coordinator on in_fd and out_fd until it sends quit or goes
+// away, searching each unit it sends. Returns a process exit status: 0
+// normally, 1 if the coordinator broke the protocol or could not be
+// answered.
+int run_distributed_worker(int in_fd = 0, int out_fd = 1) {
+  LineChannel in(in_fd), out(out_fd);
+  DistributedJob job;
+  bool have_job = false;
+  int incumbent = -1;
+  // lines read while a unit was searched
+  std::deque<std::string> waiting;
+  bool closed = false;
+
+  // apply any bounds sent since the unit began, keeping other lines
+  const std::function<int()> incumbent_now = [&]() {
+    while (!closed && in.readable(0)) {
+      if (!in.fill()) {
+	closed = true;
+      }
+      std::string line;
+      while (in.next_line(line)) {
+	std::istringstream words(line);
+	std::string command;
+	int bound;
+	if ((words >> command) && command == "bound" && (words >> bound)) {
+	  incumbent = std::max(incumbent, bound);
+	} else {
+	  waiting.push_back(line);
+	}
+      }
+    }
+    return incumbent;
+  };
+
+  for (;;) {
+    std::string line;
+    if (!waiting.empty()) {
+      line = waiting.front();
+      waiting.pop_front();
+    } else if (!in.next_line(line)) {
+      if (closed || !in.fill()) {
+	return 0;
+      }
+      continue;
+    }
+
+    std::istringstream words(line);
+    std::string command;
+    words >> command;
+    if (command == "job") {
+      have_job = parse_distributed_job(job, words);
+      if (!have_job) {
+	return 1;
+      }
+    } else if (command == "bound") {
+      int bound;
+      if (!(words >> bound)) {
+	return 1;
+      }
+      incumbent = std::max(incumbent, bound);
+    } else if (command == "unit") {
+      uint64_t unit;
+      int bound;
+      if (!have_job || !(words >> unit >> bound) || unit >= job.unit_count()) {
+	return 1;
+      }
+      incumbent = std::max(incumbent, bound);
+      const DistributedUnitResult result = run_distributed_unit(job, unit, incumbent, &incumbent_now);
+      if (!out.send_line(distributed_result_message(result))) {
+	return 1;
+      }
+    } else if (command == "quit") {
+      return 0;
+    } else {
+      return 1;
+    }
+  }
+}
+
+// Start /bin/sh -c command with its standard input and output connected
+// to a socket, storing its process id in pid and the coordinator's end
+// of the socket in fd. Returns false if it cannot be started.
+bool spawn_distributed_worker(pid_t& pid, int& fd, const std::string& command) {
+  int sockets[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+    return false;
+  }
+  // no other worker inherits this end
+  ::fcntl(sockets[0], F_SETFD, FD_CLOEXEC);
+  const char* text = command.c_str();
+  pid = ::fork();
+  if (pid < 0) {
+    ::close(sockets[0]);
+    ::close(sockets[1]);
+    return false;
+  }
+  if (pid == 0) {
+    ::dup2(sockets[1], 0);
+    ::dup2(sockets[1], 1);
+    if (sockets[1] > 1) {
+      ::close(sockets[1]);
+    }
+    ::execl("/bin/sh", "sh", "-c", text, static_cast<char*>(nullptr));
+    ::_exit(127);
+  }
+  ::close(sockets[1]);
+  fd = sockets[0];
+  return true;
+}
+
+// Wait for the worker process pid to exit, first sending it SIGTERM if
+// terminate. One that has not exited after DISTRIBUTED_STOP_MILLISECONDS,
+// because it ignores SIGTERM or is busy, is sent SIGKILL, so this never
+// waits for long.
+void reap_distributed_worker(pid_t pid, bool terminate) {
+  if (terminate) {
+    ::kill(pid, SIGTERM);
+  }
+  for (int waited = 0; waited < DISTRIBUTED_STOP_MILLISECONDS; waited += 10) {
+    const pid_t status = ::waitpid(pid, nullptr, WNOHANG);
+    if (status == pid || (status < 0 && errno != EINTR)) {
+      return;
+    }
+    ::usleep(10000);
+  }
+  ::kill(pid, SIGKILL);
+  while (::waitpid(pid, nullptr, 0) < 0 && errno == EINTR) { }
+}
+
+// Run search until it is finished, or every worker is lost, on one
+// worker process for each of worker_commands, each of which should run
+// run_distributed_worker, for instance "maxprotein_distributed worker"
+// or the same through ssh. Whenever the incumbent improves, every
+// worker is sent the new bound. A worker whose connection closes, that
+// breaks the protocol, or whose result is not valid_result(), is
+// stopped and its units are handed to the
+// others. Once every unit is handed out, an idle worker is given one
+// that another is still searching, so a slow or hung worker does not
+// hold up the job; workers still searching at the end are stopped. If
+// checkpoint_path is not empty, a checkpoint is saved there
+// at most every checkpoint_seconds while units complete, and at the
+// end; a save that fails is tried again checkpoint_seconds later, and
+// if checkpoint_failures is non-null, the number of failed saves is
+// stored there. Returns search.finished().
+bool run_distributed_search(DistributedSearch& search,
+			    const std::vector<std::string>& worker_commands,
+			    const std::string& checkpoint_path = "",
+			    int checkpoint_seconds = DISTRIBUTED_CHECKPOINT_SECONDS,
+			    size_t* checkpoint_failures = nullptr) {
+	size_t local_failures;
+	if (checkpoint_failures == nullptr)
+		checkpoint_failures = &local_failures;
+	*checkpoint_failures = 0;
+
+	struct Worker {
+		pid_t pid;
+		LineChannel channel;
+		std::vector<uint64_t> units;
+		bool alive;
+	};
+	std::vector<Worker> workers;
+	const std::string job = distributed_job_message(search.job());
+
+	auto retire = [&](Worker& worker) {
+		worker.alive = false;
+		for (uint64_t unit : worker.units)
+			search.abandon(unit);
+		worker.units.clear();
+		::close(worker.channel.fd());
+		reap_distributed_worker(worker.pid, true);
+	};
+
+	// a unit that another worker is searching, for an idle worker
+	auto straggler = [&](const Worker& idle, uint64_t& unit) {
+		for (const Worker& other : workers)
+		{
+			for (uint64_t u : other.units)
+			{
+				if (&other != &idle && other.alive && !search.unit_done(u))
+				{
+					unit = u;
+					return true;
+				}
+			}
+		}
+		return false;
+	};
+
+	for (const std::string& command : worker_commands)
+	{
+		Worker worker;
+		int fd;
+		if (!spawn_distributed_worker(worker.pid, fd, command))
+			continue;
+		worker.channel = LineChannel(fd);
+		worker.alive = true;
+		workers.push_back(worker);
+		if (!workers.back().channel.send_line(job))
+			retire(workers.back());
+	}
+
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point last_checkpoint = Clock::now();
+	bool saved = true;
+	while (!search.finished())
+	{
+		std::vector<struct pollfd> ready;
+		std::vector<size_t> ready_worker;
+		for (size_t w = 0; w < workers.size(); w++)
+		{
+			Worker& worker = workers[w];
+			uint64_t unit;
+			while (worker.alive && worker.units.size() < DISTRIBUTED_UNITS_IN_FLIGHT &&
+			       (search.next_unit(unit) || (worker.units.empty() && straggler(worker, unit))))
+			{
+				worker.units.push_back(unit);
+				std::ostringstream message;
+				message << "unit " << unit << ' ' << search.incumbent_protein();
+				if (!worker.channel.send_line(message.str()))
+					retire(worker);
+			}
+			if (worker.alive)
+			{
+				struct pollfd entry;
+				entry.fd = worker.channel.fd();
+				entry.events = POLLIN;
+				entry.revents = 0;
+				ready.push_back(entry);
+				ready_worker.push_back(w);
+			}
+		}
+		if (ready.empty())
+			break;
+
+		if (::poll(ready.data(), ready.size(), 1000) < 0 && errno != EINTR)
+			break;
+		for (size_t r = 0; r < ready.size(); r++)
+		{
+			Worker& worker = workers[ready_worker[r]];
+			if (ready[r].revents == 0 || !worker.alive)
+				continue;
+			if (!worker.channel.fill())
+			{
+				retire(worker);
+				continue;
+			}
+			std::string line;
+			while (worker.alive && worker.channel.next_line(line))
+			{
+				std::istringstream words(line);
+				std::string command;
+				DistributedUnitResult result;
+				auto unit = worker.units.end();
+				if ((words >> command) && command == "done" &&
+				    parse_distributed_result(result, words) && search.valid_result(result))
+				{
+					unit = std::find(worker.units.begin(), worker.units.end(), result.unit);
+				}
+				if (unit == worker.units.end())
+				{
+					retire(worker);
+					break;
+				}
+				worker.units.erase(unit);
+				saved = false;
+				if (search.complete(result))
+				{
+					std::ostringstream message;
+					message << "bound " << search.incumbent_protein();
+					for (Worker& other : workers)
+					{
+						if (other.alive && !other.channel.send_line(message.str()))
+							retire(other);
+					}
+				}
+			}
+		}
+
+		if (!checkpoint_path.empty() && !saved &&
+		    Clock::now() - last_checkpoint >= std::chrono::seconds(checkpoint_seconds))
+		{
+			saved = search.save_checkpoint(checkpoint_path);
+			if (!saved)
+				++*checkpoint_failures;
+			last_checkpoint = Clock::now();
+		}
+	}
+
+	for (Worker& worker : workers)
+	{
+		if (worker.alive)
+		{
+			worker.channel.send_line("quit");
+			::close(worker.channel.fd());
+			reap_distributed_worker(worker.pid, !worker.units.empty());
+		}
+	}
+	if (!checkpoint_path.empty() && !search.save_checkpoint(checkpoint_path))
+		++*checkpoint_failures;
+	return search.finished();
+}
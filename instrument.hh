@@ -0,0 +1,198 @@
+///////////////////////////////////////////////////////////////////////////////
+// instrument.hh
+//
+// Optional timing and counting of the loaders, filters and solvers, to
+// see where the time of a request goes.
+//
+// Instrumentation is compiled in only when MAXPROTEIN_INSTRUMENT is
+// defined before maxprotein.hh is included, e.g. with
+// -DMAXPROTEIN_INSTRUMENT. Otherwise INSTRUMENT_SCOPE and
+// INSTRUMENT_COUNT expand to nothing, and every total reads as zero.
+// When enabled, each scope costs two steady_clock reads and two
+// relaxed atomic adds, and the solvers add their counts once per call
+// rather than in their inner loops.
+//
+// How to use:
+//
+//    instrument_reset();
+//    auto foods = load_usda_abbrev("ABBREV.txt");  // times Phase::load
+//    ...
+//    instrument_dump(std::cout);
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+
+// The parts of a request that are timed.
+enum class Phase {
+  load,
+  filter,
+  greedy,
+  exhaustive,
+  heap_greedy,
+  gray_code,
+  parallel_gray_code,
+  meet_in_middle,
+  dp,
+  fptas,
+  branch_and_bound,
+  anytime,
+  count
+};
+
+// The quantities that are counted.
+enum class Counter {
+  // foods produced by the loaders
+  foods_loaded,
+  // bytes of ABBREV text scanned by the loaders
+  bytes_read,
+  // foods kept by the filters
+  foods_filtered,
+  // subsets whose totals were evaluated by the exhaustive solvers
+  subsets_evaluated,
+  // cells of every dp table filled
+  dp_cells,
+  // branch and bound nodes visited, and subtrees pruned
+  search_nodes,
+  search_pruned,
+  // bytes of the tables and buffers the solvers allocate
+  bytes_allocated,
+  count
+};
+
+const char* phase_name(Phase phase) {
+  static const char* const names[] = {
+    "load", "filter", "greedy", "exhaustive", "heap_greedy", "gray_code",
+    "parallel_gray_code", "meet_in_middle", "dp", "fptas", "branch_and_bound",
+    "anytime",
+  };
+  return names[int(phase)];
+}
+
+const char* counter_name(Counter counter) {
+  static const char* const names[] = {
+    "foods_loaded", "bytes_read", "foods_filtered", "subsets_evaluated",
+    "dp_cells", "search_nodes", "search_pruned", "bytes_allocated",
+  };
+  return names[int(counter)];
+}
+
+// Running totals of one phase.
+struct PhaseTotals {
+  uint64_t calls = 0;
+  double seconds = 0;
+};
+
+#ifdef MAXPROTEIN_INSTRUMENT
+const bool INSTRUMENT_ENABLED = true;
+#else
+const bool INSTRUMENT_ENABLED = false;
+#endif
+
+// Every total, shared by all threads.
+struct InstrumentData {
+  std::atomic<uint64_t> calls[int(Phase::count)];
+  std::atomic<uint64_t> nanoseconds[int(Phase::count)];
+  std::atomic<uint64_t> counters[int(Counter::count)];
+};
+
+InstrumentData& instrument_data() {
+  static InstrumentData data{};
+  return data;
+}
+
+// Set every total to zero.
+void instrument_reset() {
+  InstrumentData& data = instrument_data();
+  for (int i = 0; i < int(Phase::count); i++) {
+    data.calls[i].store(0, std::memory_order_relaxed);
+    data.nanoseconds[i].store(0, std::memory_order_relaxed);
+  }
+  for (int i = 0; i < int(Counter::count); i++) {
+    data.counters[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void instrument_count(Counter counter, uint64_t amount) {
+  instrument_data().counters[int(counter)].fetch_add(amount, std::memory_order_relaxed);
+}
+
+uint64_t instrument_counter(Counter counter) {
+  return instrument_data().counters[int(counter)].load(std::memory_order_relaxed);
+}
+
+PhaseTotals instrument_phase(Phase phase) {
+  InstrumentData& data = instrument_data();
+  PhaseTotals totals;
+  totals.calls = data.calls[int(phase)].load(std::memory_order_relaxed);
+  totals.seconds = data.nanoseconds[int(phase)].load(std::memory_order_relaxed) * 1e-9;
+  return totals;
+}
+
+// Print every phase that ran and every nonzero counter to out.
+void instrument_dump(std::ostream& out) {
+  if (!INSTRUMENT_ENABLED) {
+    out << "instrumentation disabled; build with -DMAXPROTEIN_INSTRUMENT" << std::endl;
+    return;
+  }
+  for (int i = 0; i < int(Phase::count); i++) {
+    PhaseTotals totals = instrument_phase(Phase(i));
+    if (totals.calls > 0) {
+      out << std::left << std::setw(20) << phase_name(Phase(i)) << std::right
+	  << std::setw(10) << totals.calls << " calls "
+	  << std::setw(12) << totals.seconds << " s" << std::endl;
+    }
+  }
+  for (int i = 0; i < int(Counter::count); i++) {
+    uint64_t value = instrument_counter(Counter(i));
+    if (value > 0) {
+      out << std::left << std::setw(20) << counter_name(Counter(i)) << std::right
+	  << std::setw(10) << value << std::endl;
+    }
+  }
+}
+
+// Adds the time from its construction to its destruction to a phase.
+class InstrumentScope {
+public:
+  explicit InstrumentScope(Phase phase)
+    : _phase(phase),
+      _start(std::chrono::steady_clock::now()) { }
+
+  InstrumentScope(const InstrumentScope&) = delete;
+  InstrumentScope& operator=(const InstrumentScope&) = delete;
+
+  ~InstrumentScope() {
+    const auto elapsed = std::chrono::steady_clock::now() - _start;
+    InstrumentData& data = instrument_data();
+    data.calls[int(_phase)].fetch_add(1, std::memory_order_relaxed);
+    data.nanoseconds[int(_phase)].fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+      std::memory_order_relaxed);
+  }
+
+private:
+  Phase _phase;
+  std::chrono::steady_clock::time_point _start;
+};
+
+#define INSTRUMENT_CONCAT_INNER(a, b) a##b
+#define INSTRUMENT_CONCAT(a, b) INSTRUMENT_CONCAT_INNER(a, b)
+
+// INSTRUMENT_SCOPE(phase) times the rest of the enclosing block as
+// phase. INSTRUMENT_COUNT(counter, amount) adds amount to counter.
+#ifdef MAXPROTEIN_INSTRUMENT
+#define INSTRUMENT_SCOPE(phase) \
+  InstrumentScope INSTRUMENT_CONCAT(instrument_scope_, __LINE__)(phase)
+#define INSTRUMENT_COUNT(counter, amount) \
+  instrument_count((counter), (amount))
+#else
+#define INSTRUMENT_SCOPE(phase) ((void) 0)
+#define INSTRUMENT_COUNT(counter, amount) ((void) 0)
+#endif
@@ -0,0 +1,89 @@
+///////////////////////////////////////////////////////////////////////////////
+// mappedfile.hh
+//
+// Read-only memory mapping of a whole file.
+//
+// This class depends on the POSIX mmap() interface. The mapping is
+// shared, so every process that maps the same file shares its pages
+// through the page cache.
+//
+// How to use:
+//
+//    MappedFile file;
+//    if (!file.open("ABBREV.txt")) { /* I/O error */ }
+//    // file.data() .. file.data() + file.size() is the file contents
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class MappedFile {
+public:
+  // Create a MappedFile that does not map anything yet.
+  MappedFile() : _data(nullptr), _size(0), _mtime(0) { }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+    close();
+  }
+
+  // Map the file at path, replacing any current mapping. Returns false
+  // on I/O error. An empty file maps successfully with size() 0.
+  bool open(const std::string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      ::close(fd);
+      return false;
+    }
+    _size = info.st_size;
+    _mtime = info.st_mtime;
+    if (_size > 0) {
+      void* mapping = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+      if (mapping == MAP_FAILED) {
+	::close(fd);
+	_size = 0;
+	return false;
+      }
+      _data = static_cast<const char*>(mapping);
+    }
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    return true;
+  }
+
+  // Unmap the file, if any.
+  void close() {
+    if (_data != nullptr) {
+      munmap(const_cast<char*>(_data), _size);
+    }
+    _data = nullptr;
+    _size = 0;
+    _mtime = 0;
+  }
+
+  const char* data() const { return _data; }
+  size_t size() const { return _size; }
+
+  // Last modification time of the file when it was mapped, in seconds
+  // since the epoch.
+  time_t mtime() const { return _mtime; }
+
+private:
+  const char* _data;
+  size_t _size;
+  time_t _mtime;
+};
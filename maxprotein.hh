@@ -9,16 +9,27 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <climits>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
-#include <queue>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "instrument.hh"
+#include "mappedfile.hh"
+#include "subsetsum.hh"
+
 // One food item in the USDA database.
 class Food {
 private:
@@ -70,80 +81,510 @@ public:
 // Alias for a vector of shared pointers to Food objects.
 typedef std::vector<std::shared_ptr<Food>> FoodVector;
 
+// Alias for a vector of positions of foods within a FoodTable or
+// FoodVector.
+typedef std::vector<size_t> IndexVector;
+
+// A non-owning reference to characters stored elsewhere, such as in
+// the string pool of a FoodTable. This is a minimal stand-in for
+// C++17's std::string_view.
+class StringRef {
+private:
+  const char* _data;
+  size_t _size;
+
+public:
+  StringRef() : _data(nullptr), _size(0) { }
+  StringRef(const char* data, size_t size) : _data(data), _size(size) { }
+  StringRef(const char* s) : _data(s), _size(std::strlen(s)) { }
+  StringRef(const std::string& s) : _data(s.data()), _size(s.size()) { }
+
+  const char* data() const { return _data; }
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  const char* begin() const { return _data; }
+  const char* end() const { return _data + _size; }
+
+  // Copy the characters into a new std::string.
+  std::string str() const { return std::string(_data, _size); }
+};
+
+bool operator==(const StringRef& a, const StringRef& b) {
+  return (a.size() == b.size()) && std::equal(a.begin(), a.end(), b.begin());
+}
+
+bool operator!=(const StringRef& a, const StringRef& b) {
+  return !(a == b);
+}
+
+std::ostream& operator<<(std::ostream& out, const StringRef& s) {
+  return out.write(s.data(), s.size());
+}
+
+// The foods of a FoodVector laid out as a structure of arrays. Each of
+// kcal, protein_g and amount_g is one contiguous int32_t column, so
+// solvers scan plain integers instead of chasing a shared_ptr to every
+// Food. Descriptions and amounts are characters in a single string
+// pool, where text[4i] .. text[4i + 1] is the range of offsets of the
+// description of food i and text[4i + 2] .. text[4i + 3] is the range
+// of its amount.
+//
+// The columns are immutable and shared between copies of a table, so
+// copying a FoodTable is cheap. A table built from a FoodVector also
+// shares that vector's Food objects, so converting solver results back
+// with to_food_vector returns the original shared_ptrs rather than new
+// copies.
+class FoodTable {
+private:
+  // Owned storage for the columns of a table.
+  struct Columns {
+    std::vector<int32_t> kcal, protein_g, amount_g;
+    std::vector<uint32_t> text;
+    std::string pool;
+  };
+
+  size_t _size;
+  const int32_t* _kcal;
+  const int32_t* _protein_g;
+  const int32_t* _amount_g;
+  const uint32_t* _text;
+  const char* _pool;
+
+  // The Food objects this table was built from, if any.
+  FoodVector _foods;
+
+  // Keeps whatever backs the column pointers alive.
+  std::shared_ptr<const void> _storage;
+
+public:
+  // Create an empty table.
+  FoodTable()
+    : _size(0),
+      _kcal(nullptr),
+      _protein_g(nullptr),
+      _amount_g(nullptr),
+      _text(nullptr),
+      _pool(nullptr) { }
+
+  // Create a table over columns stored elsewhere, such as in a memory
+  // mapping. Each pointer is to an array of size elements, except text,
+  // which holds 4 * size offsets into pool as described above. storage
+  // keeps the memory behind every pointer alive.
+  FoodTable(size_t size,
+	    const int32_t* kcal,
+	    const int32_t* protein_g,
+	    const int32_t* amount_g,
+	    const uint32_t* text,
+	    const char* pool,
+	    std::shared_ptr<const void> storage)
+    : _size(size),
+      _kcal(kcal),
+      _protein_g(protein_g),
+      _amount_g(amount_g),
+      _text(text),
+      _pool(pool),
+      _storage(storage) { }
+
+  // Copy the columns of foods into a new table, sharing the Food
+  // objects themselves.
+  explicit FoodTable(const FoodVector& foods)
+    : _size(foods.size()),
+      _foods(foods) {
+    std::shared_ptr<Columns> columns(new Columns);
+    columns->kcal.reserve(_size);
+    columns->protein_g.reserve(_size);
+    columns->amount_g.reserve(_size);
+    columns->text.reserve(4 * _size);
+    size_t text_size = 0;
+    for (auto& food : foods) {
+      text_size += food->description().size() + food->amount().size();
+    }
+    columns->pool.reserve(text_size);
+    for (auto& food : foods) {
+      columns->kcal.push_back(food->kcal());
+      columns->protein_g.push_back(food->protein_g());
+      columns->amount_g.push_back(food->amount_g());
+      columns->text.push_back(columns->pool.size());
+      columns->pool += food->description();
+      columns->text.push_back(columns->pool.size());
+      columns->text.push_back(columns->pool.size());
+      columns->pool += food->amount();
+      columns->text.push_back(columns->pool.size());
+    }
+    _kcal = columns->kcal.data();
+    _protein_g = columns->protein_g.data();
+    _amount_g = columns->amount_g.data();
+    _text = columns->text.data();
+    _pool = columns->pool.data();
+    _storage = columns;
+  }
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  int32_t kcal(size_t i) const { assert(i < _size); return _kcal[i]; }
+  int32_t protein_g(size_t i) const { assert(i < _size); return _protein_g[i]; }
+  int32_t amount_g(size_t i) const { assert(i < _size); return _amount_g[i]; }
+
+  StringRef description(size_t i) const {
+    assert(i < _size);
+    return StringRef(_pool + _text[4 * i], _text[4 * i + 1] - _text[4 * i]);
+  }
+
+  StringRef amount(size_t i) const {
+    assert(i < _size);
+    return StringRef(_pool + _text[4 * i + 2], _text[4 * i + 3] - _text[4 * i + 2]);
+  }
+
+  // Whole columns, each of length size(), for use in hot loops.
+  const int32_t* kcal_column() const { return _kcal; }
+  const int32_t* protein_g_column() const { return _protein_g; }
+  const int32_t* amount_g_column() const { return _amount_g; }
+
+  // Return food i as a Food object. This is the original shared_ptr
+  // when the table was built from a FoodVector.
+  std::shared_ptr<Food> food(size_t i) const {
+    assert(i < _size);
+    if (!_foods.empty()) {
+      return _foods[i];
+    }
+    return std::make_shared<Food>(description(i).str(),
+				  amount(i).str(),
+				  amount_g(i),
+				  kcal(i),
+				  protein_g(i));
+  }
+
+  // Return a new table of the foods at the given positions, in the
+  // given order. The numeric columns and text offsets are copied, but
+  // the string pool and Food objects are shared with this table.
+  FoodTable subset(const IndexVector& indices) const {
+    struct Storage {
+      std::vector<int32_t> kcal, protein_g, amount_g;
+      std::vector<uint32_t> text;
+      std::shared_ptr<const void> parent;
+    };
+    std::shared_ptr<Storage> storage(new Storage);
+    storage->parent = _storage;
+    storage->kcal.reserve(indices.size());
+    storage->protein_g.reserve(indices.size());
+    storage->amount_g.reserve(indices.size());
+    storage->text.reserve(4 * indices.size());
+    for (size_t i : indices) {
+      assert(i < _size);
+      storage->kcal.push_back(_kcal[i]);
+      storage->protein_g.push_back(_protein_g[i]);
+      storage->amount_g.push_back(_amount_g[i]);
+      storage->text.insert(storage->text.end(), _text + 4 * i, _text + 4 * i + 4);
+    }
+    FoodTable result(indices.size(),
+		     storage->kcal.data(),
+		     storage->protein_g.data(),
+		     storage->amount_g.data(),
+		     storage->text.data(),
+		     _pool,
+		     storage);
+    if (!_foods.empty()) {
+      for (size_t i : indices) {
+	result._foods.push_back(_foods[i]);
+      }
+    }
+    return result;
+  }
+
+  // Convert the foods at the given positions, in the given order, to a
+  // FoodVector.
+  std::unique_ptr<FoodVector> to_food_vector(const IndexVector& indices) const {
+    std::unique_ptr<FoodVector> result(new FoodVector);
+    result->reserve(indices.size());
+    for (size_t i : indices) {
+      result->push_back(food(i));
+    }
+    return result;
+  }
+
+  // Convert every food in the table to a FoodVector.
+  std::unique_ptr<FoodVector> to_food_vector() const {
+    if (!_foods.empty()) {
+      return std::unique_ptr<FoodVector>(new FoodVector(_foods));
+    }
+    IndexVector all(_size);
+    for (size_t i = 0; i < _size; i++) {
+      all[i] = i;
+    }
+    return to_food_vector(all);
+  }
+};
+
+// Value of a nutrient field that is empty in the ABBREV file.
+const int NUTRIENT_UNKNOWN = -1;
+
+// The fields of one line of a USDA ABBREV file that we keep. The
+// strings refer into the line itself. fat_g, carb_g and sodium_mg are
+// NUTRIENT_UNKNOWN when their field is empty, which does not make the
+// food invalid.
+struct AbbrevRecord {
+  StringRef description, amount;
+  int amount_g, kcal, protein_g;
+  int fat_g, carb_g, sodium_mg;
+};
+
+// Outcome of parsing one line of a USDA ABBREV file.
+enum class AbbrevLine {
+  // The line holds a valid food.
+  food,
+  // The line is well-formed, but the food is missing a field such as
+  // the amount string, so it should be skipped.
+  skipped,
+  // The line does not have 53 fields, so the file is not in ABBREV
+  // format.
+  malformed
+};
+
+// Parse a number field of an ABBREV line, such as "717" or "0.85",
+// rounding to the nearest integer the same way as lround. Plain
+// decimals are parsed in place; anything else, such as a sign or an
+// exponent, falls back to stream extraction. Returns false if the
+// field is not a number.
+bool parse_abbrev_number(int& output, const char* begin, const char* end) {
+  const char* p = begin;
+  int whole = 0, whole_digits = 0, fraction_digits = 0;
+  bool round_up = false;
+  for (; p != end && *p >= '0' && *p <= '9'; p++, whole_digits++) {
+    whole = 10 * whole + (*p - '0');
+  }
+  if (p != end && *p == '.') {
+    p++;
+    if (p != end && *p >= '0' && *p <= '9') {
+      round_up = (*p >= '5');
+    }
+    for (; p != end && *p >= '0' && *p <= '9'; p++, fraction_digits++) { }
+  }
+  // lround works on doubles, so leave long inputs, which might round
+  // differently, to the slow path
+  if (p == end &&
+      (whole_digits + fraction_digits) > 0 &&
+      whole_digits < 10 &&
+      (whole_digits + fraction_digits) < 16) {
+    output = whole + (round_up ? 1 : 0);
+    return true;
+  }
+
+  std::stringstream ss(std::string(begin, end));
+  double floating;
+  ss >> floating;
+  if ( ! ss ) {
+    return false;
+  } else {
+    output = lround(floating);
+    return true;
+  }
+}
+
+// Parse one line of a USDA ABBREV file, not including its newline, in
+// a single pass. Only the description, kcal, protein, fat,
+// carbohydrate, sodium, amount_g and amount fields (1, 3, 4, 5, 7, 15,
+// 48 and 49) are examined; the other fields are only counted. Fields
+// are split at each '^' the same way as successive
+// std::getline(..., '^') calls split them, so a trailing '^' does not
+// start a new field.
+AbbrevLine parse_abbrev_line(AbbrevRecord& record,
+			     const char* begin,
+			     const char* end) {
+  const int field_count = 53;
+  const char* field_begin[field_count];
+  const char* field_end[field_count];
+  int fields = 0;
+  for (const char* p = begin; p != end; ) {
+    if (fields == field_count) {
+      return AbbrevLine::malformed;
+    }
+    const char* caret = static_cast<const char*>(std::memchr(p, '^', end - p));
+    if (caret == nullptr) {
+      caret = end;
+    }
+    field_begin[fields] = p;
+    field_end[fields] = caret;
+    fields++;
+    p = (caret == end) ? end : caret + 1;
+  }
+  if (fields != field_count) {
+    return AbbrevLine::malformed;
+  }
+
+  auto remove_tildes = [&](StringRef& output, int field) {
+    const char* b = field_begin[field];
+    const char* e = field_end[field];
+    if (((e - b) < 3) || (*b != '~') || (*(e - 1) != '~')) {
+      return false;
+    } else {
+      output = StringRef(b + 1, (e - b) - 2);
+      return true;
+    }
+  };
+
+  auto parse_mil = [&](int& output, int field) {
+    return parse_abbrev_number(output, field_begin[field], field_end[field]);
+  };
+
+  auto parse_nutrient = [&](int& output, int field) {
+    if (!parse_mil(output, field)) {
+      output = NUTRIENT_UNKNOWN;
+    }
+  };
+
+  if ( remove_tildes(record.description, 1) &&
+       remove_tildes(record.amount, 49) &&
+       parse_mil(record.amount_g, 48) &&
+       parse_mil(record.kcal, 3) &&
+       parse_mil(record.protein_g, 4) ) {
+    parse_nutrient(record.fat_g, 5);
+    parse_nutrient(record.carb_g, 7);
+    parse_nutrient(record.sodium_mg, 15);
+    return AbbrevLine::food;
+  } else {
+    return AbbrevLine::skipped;
+  }
+}
+
+// Read the whole file at path into contents. Returns false on I/O
+// error.
+bool read_file(std::string& contents, const std::string& path) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) {
+    return false;
+  }
+  f.seekg(0, std::ios::end);
+  const std::streamoff size = f.tellg();
+  if (size < 0) {
+    return false;
+  }
+  contents.resize(size);
+  f.seekg(0, std::ios::beg);
+  f.read(&contents[0], size);
+  return bool(f);
+}
+
+// Call visit(record) for each valid food in the ABBREV-format text
+// begin .. end, in file order, scanning each line once with
+// parse_abbrev_line. Lines of foods that are missing fields are
+// skipped. Returns false if some line is malformed, in which case
+// visit may already have been called for earlier foods.
+template <typename Visit>
+bool for_each_abbrev_food(const char* begin, const char* end, Visit visit) {
+  for (const char* p = begin; p != end; ) {
+    const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    const char* line_end = (newline == nullptr) ? end : newline;
+
+    AbbrevRecord record;
+    switch (parse_abbrev_line(record, p, line_end)) {
+    case AbbrevLine::malformed:
+      return false;
+    case AbbrevLine::food:
+      visit(record);
+      break;
+    case AbbrevLine::skipped:
+      break;
+    }
+
+    p = (newline == nullptr) ? end : newline + 1;
+  }
+  return true;
+}
+
 // Load all the valid foods from a USDA database in their ABBREV
 // format. Foods that are missing fields such as the amount string are
 // skipped. Returns nullptr on I/O error.
+//
+// The file is read into memory with one read, and each line is
+// scanned once with parse_abbrev_line, so the only allocations are
+// for the Food objects themselves, each made with std::make_shared so
+// that it shares one allocation with its reference count.
 std::unique_ptr<FoodVector> load_usda_abbrev(const std::string& path) {
 
+  INSTRUMENT_SCOPE(Phase::load);
   std::unique_ptr<FoodVector> failure(nullptr);
-  
-  std::ifstream f(path);
-  if (!f) {
+
+  std::string contents;
+  if (!read_file(contents, path)) {
     return failure;
   }
+  INSTRUMENT_COUNT(Counter::bytes_read, contents.size());
 
   std::unique_ptr<FoodVector> result(new FoodVector);
+  bool ok = for_each_abbrev_food(contents.data(), contents.data() + contents.size(),
+				 [&](const AbbrevRecord& record) {
+    result->push_back(std::make_shared<Food>(record.description.str(),
+					     record.amount.str(),
+					     record.amount_g,
+					     record.kcal,
+					     record.protein_g));
+  });
+  if (!ok) {
+    return failure;
+  }
+  INSTRUMENT_COUNT(Counter::foods_loaded, result->size());
 
-  for (std::string line; std::getline(f, line); ) {
+  return result;
+}
 
-    std::vector<std::string> fields;
-    std::stringstream ss(line);
-    for (std::string field; std::getline(ss, field, '^'); ) {
-      fields.push_back(field);
-    }
+// Load the same foods as load_usda_abbrev into a FoodTable, without
+// copying any text. The file is memory-mapped read-only, and the
+// descriptions and amounts of the table are StringRefs into the
+// mapping, which stays mapped for as long as some copy of the table
+// exists. Only the numeric columns are allocated. Since the mapping is
+// shared, processes that load the same file also share its pages in
+// the page cache. Each food's AbbrevRecord is also passed to
+// visit(record), in file order, so a caller can keep more of its
+// fields. Returns nullptr on I/O error.
+template <typename Visit>
+std::unique_ptr<FoodTable> load_usda_abbrev_mapped(const std::string& path,
+						   Visit visit) {
 
-    if (fields.size() != 53) {
-      return failure;
-    }
-    
-    std::string descr_field = fields[1],
-                kcal_field = fields[3],
-                protein_g_field = fields[4],
-                amount_g_field = fields[48],
-                amount_field = fields[49];
-
-    auto remove_tildes = [](std::string& output,
-			    const std::string& field) {
-      if ((field.size() < 3) ||
-	  (field.front() != '~') ||
-	  (field.back() != '~')) {
-	return false;
-      } else {
-	output.assign(field.begin() + 1, field.end() - 1);
-	return true;
-      }
-    };
+  INSTRUMENT_SCOPE(Phase::load);
+  std::unique_ptr<FoodTable> failure(nullptr);
 
-    auto parse_mil = [](int& output, const std::string& field) {
-      std::stringstream ss(field);
-      double floating;
-      ss >> floating;
-      if ( ! ss ) {
-	return false;
-      } else {
-	output = lround(floating);
-	return true;
-      }
-    };
+  // everything the table points to
+  struct Storage {
+    MappedFile file;
+    std::vector<int32_t> kcal, protein_g, amount_g;
+    std::vector<uint32_t> text;
+  };
+  std::shared_ptr<Storage> storage(new Storage);
+  if (!storage->file.open(path)) {
+    return failure;
+  }
 
-    std::string description, amount;
-    int amount_g, kcal, protein_g;
-    if ( remove_tildes(description, descr_field) &&
-	 remove_tildes(amount, amount_field) &&
-	 parse_mil(amount_g, amount_g_field) &&
-	 parse_mil(kcal, kcal_field) &&
-	 parse_mil(protein_g, protein_g_field) ) {
-      result->push_back(std::shared_ptr<Food>(new Food(description,
-						       amount,
-						       amount_g,
-						       kcal,
-						       protein_g)));
-    }
+  const char* begin = storage->file.data();
+  const char* end = begin + storage->file.size();
+  bool ok = for_each_abbrev_food(begin, end, [&](const AbbrevRecord& record) {
+    storage->kcal.push_back(record.kcal);
+    storage->protein_g.push_back(record.protein_g);
+    storage->amount_g.push_back(record.amount_g);
+    storage->text.push_back(record.description.begin() - begin);
+    storage->text.push_back(record.description.end() - begin);
+    storage->text.push_back(record.amount.begin() - begin);
+    storage->text.push_back(record.amount.end() - begin);
+    visit(record);
+  });
+  if (!ok) {
+    return failure;
   }
+  INSTRUMENT_COUNT(Counter::bytes_read, end - begin);
+  INSTRUMENT_COUNT(Counter::foods_loaded, storage->kcal.size());
 
-  f.close();
+  return std::unique_ptr<FoodTable>(new FoodTable(storage->kcal.size(),
+						  storage->kcal.data(),
+						  storage->protein_g.data(),
+						  storage->amount_g.data(),
+						  storage->text.data(),
+						  begin,
+						  storage));
+}
 
-  return result;
+// Same as above, keeping only the fields a FoodTable holds.
+std::unique_ptr<FoodTable> load_usda_abbrev_mapped(const std::string& path) {
+  return load_usda_abbrev_mapped(path, [](const AbbrevRecord&) { });
 }
 
 // Convenience function to compute the total kilocalories and protein
@@ -178,6 +619,13 @@ void print_food_vector(const FoodVector& foods) {
 	    << std::endl;
 }
 
+// Return true if a food with the given kilocalories matches the
+// criteria of filter_food_vector: nonzero, at least min_kcal and at
+// most max_kcal.
+bool kcal_matches_filter(int kcal, int min_kcal, int max_kcal) {
+	return kcal != 0 && kcal >= min_kcal && kcal <= max_kcal;
+}
+
 // Filter the vector source, i.e. create and return a new FoodVector
 // containing the subset of the foods in source that match given
 // criteria. This is intended to 1) filter out foods with zero
@@ -191,20 +639,170 @@ std::unique_ptr<FoodVector> filter_food_vector(const FoodVector& source,
 					       int min_kcal,
 					       int max_kcal,
 					       int total_size) {
+	INSTRUMENT_SCOPE(Phase::filter);
 	std::unique_ptr<FoodVector> filteredFood(new FoodVector);
 	int size = source.size();
 	int total_size_counter = 0;
 	for(int n = 0; n < size && total_size_counter < total_size; n++)
 	{
-		if(source[n]->kcal() !=0 && source[n]->kcal() >= min_kcal && source[n]->kcal() <= max_kcal)
+		if(kcal_matches_filter(source[n]->kcal(), min_kcal, max_kcal))
 		{
 			filteredFood->push_back(source[n]);
 			total_size_counter++;
 		}
 	}
+	INSTRUMENT_COUNT(Counter::foods_filtered, filteredFood->size());
 	return filteredFood;
 }
 
+// An index of a food database by kilocalories, built once so that
+// repeated filter_food_vector queries with different kcal windows do
+// not each scan every food. The kcal values are sorted, each alongside
+// the original position of its food, so a query finds the foods in
+// its window with two binary searches. Only the matching foods are
+// then visited to pick the first total_size of them in original
+// order.
+class FoodIndex {
+private:
+  // kcal values in increasing order, and the position of each one's
+  // food; equal kcal values are in position order
+  std::vector<int32_t> _kcal;
+  std::vector<uint32_t> _position;
+
+  void build(const int32_t* kcal, size_t size) {
+    std::vector<std::pair<int32_t, uint32_t>> entries(size);
+    for (size_t i = 0; i < size; i++) {
+      entries[i] = std::make_pair(kcal[i], uint32_t(i));
+    }
+    std::sort(entries.begin(), entries.end());
+    _kcal.resize(size);
+    _position.resize(size);
+    for (size_t i = 0; i < size; i++) {
+      _kcal[i] = entries[i].first;
+      _position[i] = entries[i].second;
+    }
+  }
+
+public:
+  // Index the foods of a table.
+  explicit FoodIndex(const FoodTable& foods) {
+    build(foods.kcal_column(), foods.size());
+  }
+
+  // Index the foods of a vector.
+  explicit FoodIndex(const FoodVector& foods) {
+    std::vector<int32_t> kcal(foods.size());
+    for (size_t i = 0; i < foods.size(); i++) {
+      kcal[i] = foods[i]->kcal();
+    }
+    build(kcal.data(), kcal.size());
+  }
+
+  size_t size() const { return _kcal.size(); }
+
+  // Return the positions, in increasing order, of the foods that
+  // filter_food_vector would choose with the same arguments: the
+  // first total_size foods with nonzero kcal between min_kcal and
+  // max_kcal inclusive.
+  IndexVector filter(int min_kcal, int max_kcal, int total_size) const {
+    INSTRUMENT_SCOPE(Phase::filter);
+    // kcal is never negative, so excluding zero raises the minimum
+    const int low = std::max(min_kcal, 1);
+    IndexVector result;
+    if (low > max_kcal || total_size <= 0) {
+      return result;
+    }
+    const size_t first = std::lower_bound(_kcal.begin(), _kcal.end(), low) - _kcal.begin(),
+      last = std::upper_bound(_kcal.begin(), _kcal.end(), max_kcal) - _kcal.begin();
+    result.assign(_position.begin() + first, _position.begin() + last);
+    if (result.size() > size_t(total_size)) {
+      std::nth_element(result.begin(), result.begin() + total_size, result.end());
+      result.resize(total_size);
+    }
+    std::sort(result.begin(), result.end());
+    INSTRUMENT_COUNT(Counter::foods_filtered, result.size());
+    return result;
+  }
+};
+
+// Same as filter_food_vector(source, min_kcal, max_kcal, total_size),
+// answered with index, which must have been built over source.
+std::unique_ptr<FoodVector> filter_food_vector(const FoodVector& source,
+					       const FoodIndex& index,
+					       int min_kcal,
+					       int max_kcal,
+					       int total_size) {
+	assert(index.size() == source.size());
+	std::unique_ptr<FoodVector> filteredFood(new FoodVector);
+	for (size_t i : index.filter(min_kcal, max_kcal, total_size))
+		filteredFood->push_back(source[i]);
+	return filteredFood;
+}
+
+// Load only the first total_size valid foods of a USDA ABBREV file for
+// which keep(record) returns true, where record is the AbbrevRecord of
+// the food. The file is read one line at a time into a reused buffer
+// and reading stops as soon as total_size foods have been kept, so the
+// work is proportional to how far into the file those foods are, and
+// no Food is allocated for a rejected line. Returns nullptr on I/O
+// error or if a line before the last food kept is malformed; unlike
+// load_usda_abbrev, lines after it are never read, so they are not
+// checked.
+template <typename Predicate>
+std::unique_ptr<FoodVector> load_usda_abbrev_if(const std::string& path,
+						Predicate keep,
+						int total_size) {
+
+  INSTRUMENT_SCOPE(Phase::load);
+  std::unique_ptr<FoodVector> failure(nullptr);
+
+  std::ifstream f(path, std::ios::binary);
+  if (!f) {
+    return failure;
+  }
+
+  std::unique_ptr<FoodVector> result(new FoodVector);
+
+  std::string line;
+  while ((int(result->size()) < total_size) && std::getline(f, line)) {
+    AbbrevRecord record;
+    INSTRUMENT_COUNT(Counter::bytes_read, line.size() + 1);
+    switch (parse_abbrev_line(record, line.data(), line.data() + line.size())) {
+    case AbbrevLine::malformed:
+      return failure;
+    case AbbrevLine::food:
+      if (keep(record)) {
+	result->push_back(std::make_shared<Food>(record.description.str(),
+						 record.amount.str(),
+						 record.amount_g,
+						 record.kcal,
+						 record.protein_g));
+      }
+      break;
+    case AbbrevLine::skipped:
+      break;
+    }
+  }
+  INSTRUMENT_COUNT(Counter::foods_loaded, result->size());
+
+  return result;
+}
+
+// Load the same foods as
+// filter_food_vector(*load_usda_abbrev(path), min_kcal, max_kcal, total_size)
+// without ever building the full FoodVector, using
+// load_usda_abbrev_if.
+std::unique_ptr<FoodVector> load_filtered_usda_abbrev(const std::string& path,
+						      int min_kcal,
+						      int max_kcal,
+						      int total_size) {
+  return load_usda_abbrev_if(path,
+			     [=](const AbbrevRecord& record) {
+			       return kcal_matches_filter(record.kcal, min_kcal, max_kcal);
+			     },
+			     total_size);
+}
+
 // Compute the optimal set of foods with a greedy
 // algorithm. Specifically, among the food items that fit within a
 // total_kcal calorie budget, choose the food whose protein is
@@ -212,6 +810,7 @@ std::unique_ptr<FoodVector> filter_food_vector(const FoodVector& source,
 // we've run out of foods, or run out of calories.
 std::unique_ptr<FoodVector> greedy_max_protein(const FoodVector& foods,
 					       int total_kcal) {
+	INSTRUMENT_SCOPE(Phase::greedy);
 	FoodVector todo(foods);
 	std::unique_ptr<FoodVector> result(new FoodVector);
 	int size = todo.size();
@@ -249,6 +848,7 @@ std::unique_ptr<FoodVector> greedy_max_protein(const FoodVector& foods,
 // vector must be less than 64.
 std::unique_ptr<FoodVector> exhaustive_max_protein(const FoodVector& foods,
 						   int total_kcal) {
+	INSTRUMENT_SCOPE(Phase::exhaustive);
  	const int n = foods.size();
 	int total_calories= 0;
 	int total_protein= 0;
@@ -286,5 +886,1399 @@ std::unique_ptr<FoodVector> exhaustive_max_protein(const FoodVector& foods,
 		total_protein = 0;
 		total_calories = 0;
 	}
+	INSTRUMENT_COUNT(Counter::subsets_evaluated, uint64_t(1) << n);
+	return result;
+}
+
+// 64-bit FNV-1a hash of size bytes, continuing from hash.
+uint64_t fnv1a_hash(const void* data,
+		    size_t size,
+		    uint64_t hash = 14695981039346656037ULL) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Hash of the kcal and protein columns of a table, which are all that
+// the solvers look at. Tables with equal hashes almost certainly get
+// the same answer from every solver.
+uint64_t food_table_hash(const FoodTable& foods) {
+  const uint64_t size = foods.size();
+  uint64_t hash = fnv1a_hash(&size, sizeof(size));
+  hash = fnv1a_hash(foods.kcal_column(), size * sizeof(int32_t), hash);
+  return fnv1a_hash(foods.protein_g_column(), size * sizeof(int32_t), hash);
+}
+
+// Convenience function to compute the total kilocalories and protein
+// of the foods at the given positions in a FoodTable. Those values
+// are returned through the first two pass-by-reference arguments.
+void sum_food_table(int& total_kcal,
+		    int& total_protein_g,
+		    const FoodTable& table,
+		    const IndexVector& indices) {
+  total_kcal = total_protein_g = 0;
+  for (size_t i : indices) {
+    total_kcal += table.kcal(i);
+    total_protein_g += table.protein_g(i);
+  }
+}
+
+// Store the positions of the bits that are set in mask, in increasing
+// order, in result, reusing its memory.
+void indices_in_mask(IndexVector& result, uint64_t mask) {
+  result.clear();
+  for (; mask != 0; mask &= mask - 1) {
+    result.push_back(lowest_set_bit(mask));
+  }
+}
+
+// The positions of the bits that are set in mask, in increasing order.
+IndexVector indices_in_mask(uint64_t mask) {
+  IndexVector result;
+  indices_in_mask(result, mask);
+  return result;
+}
+
+// Compute the same optimal set of foods as exhaustive_max_protein,
+// but visit the subsets in Gray-code order. Consecutive subsets differ
+// by exactly one food, so the running kcal and protein totals are
+// updated with a single add or subtract per subset, and only the best
+// bitmask is remembered; the result is built once at the end. Among
+// subsets with equal protein, the numerically smallest bitmask wins,
+// which matches exhaustive_max_protein whenever the optimum has
+// positive protein. The subsets are evaluated a block at a time by the
+// given subset-sum kernel, by default the widest one this CPU
+// supports. Returns the positions of the chosen foods in increasing
+// order. The size of the table must be less than 64.
+//
+// This version stores the positions in result, reusing its memory, so
+// it does not allocate once result is big enough.
+void gray_code_max_protein(IndexVector& result,
+			   const FoodTable& foods,
+			   int total_kcal,
+			   SubsetSumKernel kernel = best_subset_sum_kernel()) {
+	INSTRUMENT_SCOPE(Phase::gray_code);
+	const int n = foods.size();
+	assert(n < 64);
+	INSTRUMENT_COUNT(Counter::subsets_evaluated, uint64_t(1) << n);
+	kernel = subset_sum_kernel_for(n, kernel);
+	GrayCodeBest best;
+	subset_sum_scan(best, foods.kcal_column(), foods.protein_g_column(), n,
+			0, uint64_t(1) << (n - subset_sum_low_bits(kernel)),
+			total_kcal, kernel);
+	indices_in_mask(result, best.mask);
+}
+
+// Same as above, returning a new vector.
+IndexVector gray_code_max_protein(const FoodTable& foods,
+				  int total_kcal,
+				  SubsetSumKernel kernel = best_subset_sum_kernel()) {
+	IndexVector result;
+	gray_code_max_protein(result, foods, total_kcal, kernel);
+	return result;
+}
+
+// Same as above, on a FoodVector.
+std::unique_ptr<FoodVector> gray_code_max_protein(const FoodVector& foods,
+						  int total_kcal) {
+	FoodTable table(foods);
+	return table.to_food_vector(gray_code_max_protein(table, total_kcal));
+}
+
+// Exhaustive search for a table of exactly N foods, with N fixed at
+// compile time so every loop bound is a constant. The sums of every
+// subset of the L = N / 2 low foods are tabulated once in std::arrays.
+// Each subset of the high foods then checks all 2^L low subsets for
+// one that fits and beats the best so far in one fixed-length loop
+// with no branches, which the compiler unrolls and vectorizes. Only a
+// block that has one is scanned again, in mask order, so as in
+// gray_code_max_protein the numerically smallest best mask wins.
+// Returns the best mask, and its protein in best_protein, or -1 if no
+// subset fits.
+template <size_t N>
+uint64_t fixed_exhaustive_mask(int& best_protein,
+			       const int32_t* kcal,
+			       const int32_t* protein,
+			       int total_kcal) {
+	static_assert(N <= 20, "fixed_exhaustive_mask is for small N");
+	const size_t L = N / 2, H = N - L;
+	std::array<int32_t, size_t(1) << L> low_kcal, low_protein;
+	low_kcal[0] = low_protein[0] = 0;
+	for (size_t j = 0; j < L; j++)
+	{
+		for (size_t mask = 0; mask < (size_t(1) << j); mask++)
+		{
+			low_kcal[mask | (size_t(1) << j)] = low_kcal[mask] + kcal[j];
+			low_protein[mask | (size_t(1) << j)] = low_protein[mask] + protein[j];
+		}
+	}
+
+	uint64_t best_mask = 0;
+	best_protein = -1;
+	for (size_t high = 0; high < (size_t(1) << H); high++)
+	{
+		int32_t high_kcal = 0, high_protein = 0;
+		for (size_t j = 0; j < H; j++)
+		{
+			const int32_t take = -int32_t((high >> j) & 1);
+			high_kcal += kcal[L + j] & take;
+			high_protein += protein[L + j] & take;
+		}
+		// whether any low subset fits and beats the best so far
+		const int32_t left = total_kcal - high_kcal, need = best_protein - high_protein;
+		int32_t any = 0;
+		for (size_t low = 0; low < low_kcal.size(); low++)
+			any |= int32_t(low_kcal[low] <= left) & int32_t(low_protein[low] > need);
+		if (any == 0)
+			continue;
+		for (size_t low = 0; low < low_kcal.size(); low++)
+		{
+			if (low_kcal[low] <= left && low_protein[low] + high_protein > best_protein)
+			{
+				best_protein = low_protein[low] + high_protein;
+				best_mask = (uint64_t(high) << L) | low;
+			}
+		}
+	}
+	INSTRUMENT_COUNT(Counter::subsets_evaluated, uint64_t(1) << N);
+	return best_mask;
+}
+
+// Compute the same optimal set of foods as gray_code_max_protein for a
+// table of exactly N foods, with fixed_exhaustive_mask. Returns the
+// positions of the chosen foods in increasing order.
+template <size_t N>
+IndexVector exhaustive_max_protein(const FoodTable& foods,
+				   int total_kcal) {
+	INSTRUMENT_SCOPE(Phase::exhaustive);
+	assert(foods.size() == N);
+	int protein;
+	const uint64_t mask = fixed_exhaustive_mask<N>(protein, foods.kcal_column(),
+						      foods.protein_g_column(), total_kcal);
+	return (protein < 0) ? IndexVector() : indices_in_mask(mask);
+}
+
+// Largest table that exhaustive_max_protein solves with a kernel
+// specialized for its size. Past about 5 foods the subset-sum kernels
+// of gray_code_max_protein, which use AVX2 or AVX-512 when the CPU has
+// them whatever the compiler flags, are faster.
+const size_t FIXED_EXHAUSTIVE_MAX_N = 5;
+
+// Compute the same optimal set of foods as gray_code_max_protein, with
+// the exhaustive_max_protein<N> kernel for the table's size when it
+// has at most FIXED_EXHAUSTIVE_MAX_N foods, and with
+// gray_code_max_protein otherwise. The size of the table must be less
+// than 64.
+IndexVector exhaustive_max_protein(const FoodTable& foods,
+				   int total_kcal) {
+	typedef IndexVector (*Kernel)(const FoodTable&, int);
+	static const Kernel kernels[FIXED_EXHAUSTIVE_MAX_N + 1] = {
+		exhaustive_max_protein<0>, exhaustive_max_protein<1>,
+		exhaustive_max_protein<2>, exhaustive_max_protein<3>,
+		exhaustive_max_protein<4>, exhaustive_max_protein<5>,
+	};
+	if (foods.size() <= FIXED_EXHAUSTIVE_MAX_N)
+		return kernels[foods.size()](foods, total_kcal);
+	return gray_code_max_protein(foods, total_kcal);
+}
+
+// Compute the same optimal set of foods as gray_code_max_protein,
+// bit for bit, using threads threads; 0 means one per hardware
+// thread. The Gray-code ranks are split into fixed-size chunks that
+// threads claim from an atomic counter. Each thread keeps its own best
+// subset, and the per-thread bests are reduced with the same
+// protein-then-smallest-mask rule as the serial scan, so the answer
+// does not depend on scheduling. The size of the table must be less
+// than 64.
+IndexVector parallel_gray_code_max_protein(const FoodTable& foods,
+					   int total_kcal,
+					   int threads = 0,
+					   SubsetSumKernel kernel = best_subset_sum_kernel()) {
+	INSTRUMENT_SCOPE(Phase::parallel_gray_code);
+	const int n = foods.size();
+	assert(n < 64);
+	assert(threads >= 0);
+	INSTRUMENT_COUNT(Counter::subsets_evaluated, uint64_t(1) << n);
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	kernel = subset_sum_kernel_for(n, kernel);
+
+	// in units of blocks of the kernel
+	const int low_bits = subset_sum_low_bits(kernel);
+	const uint64_t ranks = uint64_t(1) << (n - low_bits);
+	const uint64_t chunk = uint64_t(1) << (16 - low_bits);
+	std::atomic<uint64_t> next(0);
+	std::vector<GrayCodeBest> bests(threads);
+	auto work = [&](int t) {
+		for (uint64_t first; (first = next.fetch_add(chunk)) < ranks; )
+			subset_sum_scan(bests[t], foods.kcal_column(), foods.protein_g_column(), n,
+					first, std::min(first + chunk, ranks), total_kcal, kernel);
+	};
+	std::vector<std::thread> workers;
+	for (int t = 1; t < threads; t++)
+		workers.push_back(std::thread(work, t));
+	work(0);
+	for (auto& worker : workers)
+		worker.join();
+
+	GrayCodeBest best;
+	for (auto& thread_best : bests)
+	{
+		if (thread_best.protein_g >= 0)
+			best.offer(thread_best.protein_g, thread_best.mask);
+	}
+	return indices_in_mask(best.mask);
+}
+
+// Same as above, on a FoodVector.
+std::unique_ptr<FoodVector> parallel_gray_code_max_protein(const FoodVector& foods,
+							   int total_kcal,
+							   int threads = 0) {
+	FoodTable table(foods);
+	return table.to_food_vector(parallel_gray_code_max_protein(table, total_kcal, threads));
+}
+
+// Memory reused between calls of meet_in_middle_max_protein: the
+// subsets of each half.
+struct MeetInMiddleWorkspace {
+  std::vector<HalfSubset> frontier, low;
+};
+
+// Compute the optimal set of foods exactly, like
+// exhaustive_max_protein, with the meet-in-the-middle technique. The
+// foods are split into two halves. Every subset of the second half is
+// enumerated, sorted by kcal and reduced to its Pareto frontier, on
+// which protein strictly increases with kcal. Then every subset of the
+// first half is enumerated and combined with the best frontier entry
+// that fits in the remaining budget, found by binary search. This
+// takes O(2^(n/2) n) time and O(2^(n/2)) space instead of O(2^n n).
+// Both halves are enumerated by the given subset-sum kernel. Returns
+// the positions of the chosen foods in increasing order. The size of
+// the table must be at most 62, so that each half has fewer than 32
+// foods and its masks fit in HalfSubset.
+//
+// This version stores the positions in result and keeps the half
+// subsets in workspace, reusing the memory of both, so it does not
+// allocate once they are big enough.
+void meet_in_middle_max_protein(IndexVector& result,
+				const FoodTable& foods,
+				int total_kcal,
+				MeetInMiddleWorkspace& workspace,
+				SubsetSumKernel kernel = best_subset_sum_kernel()) {
+	INSTRUMENT_SCOPE(Phase::meet_in_middle);
+	const int n = foods.size();
+	assert(n <= 62);
+	result.clear();
+	if (total_kcal < 0)
+		return;
+
+	const int low_count = n / 2, high_count = n - low_count;
+	const int32_t* kcal = foods.kcal_column();
+	const int32_t* protein = foods.protein_g_column();
+
+	std::vector<HalfSubset>& frontier = workspace.frontier;
+	frontier.clear();
+	subset_sum_collect(frontier, kcal + low_count, protein + low_count,
+			   high_count, total_kcal, kernel);
+	std::sort(frontier.begin(), frontier.end(),
+		  [](const HalfSubset& a, const HalfSubset& b) {
+			  return (a.kcal < b.kcal) ||
+				 (a.kcal == b.kcal && a.mask < b.mask);
+		  });
+	// keep only entries that beat every cheaper entry
+	size_t kept = 0;
+	for (size_t i = 0; i < frontier.size(); i++)
+	{
+		if (kept == 0 || frontier[i].protein_g > frontier[kept - 1].protein_g)
+			frontier[kept++] = frontier[i];
+	}
+	frontier.resize(kept);
+
+	std::vector<HalfSubset>& low = workspace.low;
+	low.clear();
+	subset_sum_collect(low, kcal, protein, low_count, total_kcal, kernel);
+	INSTRUMENT_COUNT(Counter::subsets_evaluated,
+			 (uint64_t(1) << low_count) + (uint64_t(1) << high_count));
+	INSTRUMENT_COUNT(Counter::bytes_allocated,
+			 (frontier.capacity() + low.capacity()) * sizeof(HalfSubset));
+
+	int best_protein = -1;
+	uint32_t best_low = 0, best_high = 0;
+	for (auto& subset : low)
+	{
+		const int remaining = total_kcal - subset.kcal;
+		// first frontier entry that does not fit
+		auto it = std::upper_bound(frontier.begin(), frontier.end(), remaining,
+					   [](int budget, const HalfSubset& entry) {
+						   return budget < entry.kcal;
+					   });
+		assert(it != frontier.begin());
+		--it;
+		if (subset.protein_g + it->protein_g > best_protein)
+		{
+			best_protein = subset.protein_g + it->protein_g;
+			best_low = subset.mask;
+			best_high = it->mask;
+		}
+	}
+
+	indices_in_mask(result, best_low | (uint64_t(best_high) << low_count));
+}
+
+// Same as above, returning a new vector.
+IndexVector meet_in_middle_max_protein(const FoodTable& foods,
+				       int total_kcal,
+				       SubsetSumKernel kernel = best_subset_sum_kernel()) {
+	IndexVector result;
+	MeetInMiddleWorkspace workspace;
+	meet_in_middle_max_protein(result, foods, total_kcal, workspace, kernel);
+	return result;
+}
+
+// Same as above, on a FoodVector.
+std::unique_ptr<FoodVector> meet_in_middle_max_protein(const FoodVector& foods,
+						       int total_kcal) {
+	FoodTable table(foods);
+	return table.to_food_vector(meet_in_middle_max_protein(table, total_kcal));
+}
+
+// The 0/1 knapsack dynamic programming table over calorie budgets.
+// After processing every food, best[c] holds the greatest protein
+// achievable within c kcal, for every budget c up to max_kcal, so one
+// pass answers all of those budgets at once. best is updated in place
+// from high c to low c for each food, and whether each food was taken
+// at each budget is recorded in a bitset of n * (max_kcal + 1) bits.
+// Walking those bits backwards from any budget reconstructs an optimal
+// set for that budget, which is only done on request. Building takes
+// O(n max_kcal) time, and O(max_kcal) words plus O(n max_kcal) bits of
+// space; every food in ABBREV.txt up to 5000 kcal needs about 5 MB.
+class ProteinCurve {
+public:
+  // Create a curve of no foods for a budget of 0 kcal.
+  ProteinCurve()
+    : _width(1),
+      _best(1, 0) { }
+
+  // Solve for every budget from 0 through max_kcal, which must be
+  // non-negative.
+  ProteinCurve(const FoodTable& foods, int max_kcal) {
+    solve(foods, max_kcal);
+  }
+
+  // Solve again for other foods and budgets, as the constructor does,
+  // reusing this curve's memory. Once it is big enough for the largest
+  // problem, this does not allocate. If stop is non-null, it is called
+  // before every 16th food, and once it returns true the solve gives up
+  // and returns false, leaving the curve meaningless. Otherwise returns
+  // true.
+  bool solve(const FoodTable& foods,
+	     int max_kcal,
+	     const std::function<bool()>* stop = nullptr) {
+    INSTRUMENT_SCOPE(Phase::dp);
+    assert(max_kcal >= 0);
+    _kcal.assign(foods.kcal_column(), foods.kcal_column() + foods.size());
+    _width = size_t(max_kcal) + 1;
+    _best.assign(_width, 0);
+    _taken.assign((foods.size() * _width + 63) / 64, 0);
+    INSTRUMENT_COUNT(Counter::dp_cells, foods.size() * _width);
+    INSTRUMENT_COUNT(Counter::bytes_allocated,
+		     _best.capacity() * sizeof(int) + _taken.capacity() * sizeof(uint64_t));
+    const int32_t* protein = foods.protein_g_column();
+    for (size_t i = 0; i < _kcal.size(); i++) {
+      if (stop != nullptr && (i % 16) == 0 && (*stop)()) {
+	return false;
+      }
+      const size_t row = i * _width;
+      for (int c = max_kcal; c >= _kcal[i]; c--) {
+	const int with = _best[c - _kcal[i]] + protein[i];
+	if (with > _best[c]) {
+	  _best[c] = with;
+	  const size_t bit = row + c;
+	  _taken[bit / 64] |= uint64_t(1) << (bit % 64);
+	}
+      }
+    }
+    return true;
+  }
+
+  int max_kcal() const { return _width - 1; }
+
+  // Greatest protein achievable within total_kcal, in O(1) time.
+  int protein_g(int total_kcal) const {
+    assert(total_kcal >= 0 && total_kcal <= max_kcal());
+    return _best[total_kcal];
+  }
+
+  // Greatest protein for each budget from 0 through max_kcal.
+  const std::vector<int>& curve() const { return _best; }
+
+  // Reconstruct an optimal set of foods within total_kcal, in O(n)
+  // time. Returns their positions in increasing order.
+  IndexVector foods(int total_kcal) const {
+    IndexVector result;
+    foods(result, total_kcal);
+    return result;
+  }
+
+  // Same as above, storing the positions in result and reusing its
+  // memory.
+  void foods(IndexVector& result, int total_kcal) const {
+    assert(total_kcal >= 0 && total_kcal <= max_kcal());
+    result.clear();
+    int c = total_kcal;
+    for (size_t i = _kcal.size(); i-- > 0; ) {
+      const size_t bit = i * _width + c;
+      if ((_taken[bit / 64] >> (bit % 64)) & 1) {
+	result.push_back(i);
+	c -= _kcal[i];
+      }
+    }
+    std::reverse(result.begin(), result.end());
+  }
+
+private:
+  std::vector<int32_t> _kcal;
+  size_t _width;
+  std::vector<int> _best;
+  std::vector<uint64_t> _taken;
+};
+
+// Compute the optimal set of foods exactly with 0/1 knapsack dynamic
+// programming over the calorie budget, as described for ProteinCurve.
+// Returns the positions of the chosen foods in increasing order.
+IndexVector dp_max_protein(const FoodTable& foods,
+			   int total_kcal) {
+	if (total_kcal < 0)
+		return IndexVector();
+	return ProteinCurve(foods, total_kcal).foods(total_kcal);
+}
+
+// Same as above, storing the positions in result and solving in curve,
+// reusing the memory of both.
+void dp_max_protein(IndexVector& result,
+		    const FoodTable& foods,
+		    int total_kcal,
+		    ProteinCurve& curve) {
+	result.clear();
+	if (total_kcal < 0)
+		return;
+	curve.solve(foods, total_kcal);
+	curve.foods(result, total_kcal);
+}
+
+// Same as above, on a FoodVector.
+std::unique_ptr<FoodVector> dp_max_protein(const FoodVector& foods,
+					   int total_kcal) {
+	FoodTable table(foods);
+	return table.to_food_vector(dp_max_protein(table, total_kcal));
+}
+
+// Compute a set of foods within total_kcal with at least (1 - epsilon)
+// times the optimal protein, for 0 < epsilon < 1, in time and bits
+// O(n^2 / epsilon) that do not depend on total_kcal.
+//
+// This is the profit-indexed knapsack dp: for each protein total it
+// finds the fewest kcal reaching it. Protein is first divided by K =
+// epsilon L / n and rounded down, where L, the better of the density
+// greedy set and the single best food, is at least half the optimum.
+// Rounding loses less than K per food, so at most epsilon L in all,
+// and no set can reach more than 2n / epsilon scaled protein. When K
+// would be less than 1, protein is not scaled and the answer is exact.
+// Returns the positions of the chosen foods in increasing order.
+IndexVector fptas_max_protein(const FoodTable& foods,
+			      int total_kcal,
+			      double epsilon) {
+	INSTRUMENT_SCOPE(Phase::fptas);
+	assert(epsilon > 0 && epsilon < 1);
+	IndexVector result;
+	if (total_kcal < 0)
+		return result;
+
+	// foods that could be part of a set, by decreasing protein/kcal
+	IndexVector candidates;
+	for (size_t i = 0; i < foods.size(); i++)
+	{
+		if (foods.protein_g(i) > 0 && foods.kcal(i) <= total_kcal)
+			candidates.push_back(i);
+	}
+	std::sort(candidates.begin(), candidates.end(), [&](size_t a, size_t b) {
+		return int64_t(foods.protein_g(a)) * foods.kcal(b) >
+		       int64_t(foods.protein_g(b)) * foods.kcal(a);
+	});
+	// the density greedy set, the fractional knapsack bound, and the
+	// single best food
+	int64_t greedy = 0, used = 0, single = 0;
+	double bound = 0;
+	bool filled = false;
+	for (size_t i : candidates)
+	{
+		single = std::max<int64_t>(single, foods.protein_g(i));
+		if (used + foods.kcal(i) <= total_kcal)
+		{
+			used += foods.kcal(i);
+			greedy += foods.protein_g(i);
+			if (!filled)
+				bound += foods.protein_g(i);
+		}
+		else if (!filled)
+		{
+			bound += double(total_kcal - used) * foods.protein_g(i) / foods.kcal(i);
+			filled = true;
+		}
+	}
+	const double lower = double(std::max(greedy, single));
+	const size_t n = candidates.size();
+	if (n == 0)
+		return result;
+	const double scale = std::max(1.0, epsilon * lower / n);
+	const size_t width = size_t(bound / scale + 1e-9) + 1;
+
+	// least kcal for each scaled protein total, INT_MAX when out of reach
+	std::vector<int> least(width, INT_MAX);
+	std::vector<uint64_t> taken((n * width + 63) / 64, 0);
+	std::vector<int> scaled(n);
+	least[0] = 0;
+	INSTRUMENT_COUNT(Counter::dp_cells, n * width);
+	INSTRUMENT_COUNT(Counter::bytes_allocated,
+			 least.capacity() * sizeof(int) + taken.capacity() * sizeof(uint64_t));
+	for (size_t k = 0; k < n; k++)
+	{
+		const int kcal = foods.kcal(candidates[k]);
+		scaled[k] = int(foods.protein_g(candidates[k]) / scale);
+		const size_t row = k * width;
+		if (scaled[k] == 0)
+			continue;
+		for (size_t q = width - 1; q >= size_t(scaled[k]); q--)
+		{
+			const int from = least[q - scaled[k]];
+			if (from != INT_MAX && from + kcal < least[q] && from + kcal <= total_kcal)
+			{
+				least[q] = from + kcal;
+				const size_t bit = row + q;
+				taken[bit / 64] |= uint64_t(1) << (bit % 64);
+			}
+		}
+	}
+
+	size_t q = width - 1;
+	while (least[q] == INT_MAX)
+		q--;
+	for (size_t k = n; k-- > 0; )
+	{
+		const size_t bit = k * width + q;
+		if ((taken[bit / 64] >> (bit % 64)) & 1)
+		{
+			result.push_back(candidates[k]);
+			q -= scaled[k];
+		}
+	}
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+// Same as above, on a FoodVector.
+std::unique_ptr<FoodVector> fptas_max_protein(const FoodVector& foods,
+					      int total_kcal,
+					      double epsilon) {
+	FoodTable table(foods);
+	return table.to_food_vector(fptas_max_protein(table, total_kcal, epsilon));
+}
+
+// An exact solver for one calorie budget over a food list that
+// changes over time, so that small edits to a large list do not cost a
+// whole new O(n total_kcal) solve.
+//
+// The foods present at the last rebuild form the base. For the base it
+// keeps every prefix knapsack layer prefix[i], the best protein per
+// budget using base foods 0..i-1, and every suffix layer suffix[i],
+// using base foods i..n-1. Edits are kept on the side: the base foods
+// removed since, and the foods added since. To answer, the prefix
+// layer before the first removed base food is extended with the
+// middle foods, the surviving base foods between the first and last
+// removed ones and then the added foods, one O(total_kcal) layer each,
+// and combined with the suffix layer after the last removed food in
+// O(total_kcal). The extended layers are kept between answers, and
+// only those after the first middle food an edit changes are redone.
+//
+// So adding a food costs one O(total_kcal) layer, and removing a base
+// food costs one layer per middle food from the first one the removal
+// changes, which is O(total_kcal) for a food next to earlier removals
+// but grows with the distance between the removed foods: removing the
+// first and last base foods costs as much as a rebuild. Removing an
+// added food redoes the layers of the foods added after it. A rebuild
+// happens automatically once the middle foods would cost more than
+// about half of one.
+//
+// The layers take about 8 n (total_kcal + 1) bytes, so this suits
+// curated lists of up to a few thousand foods.
+class IncrementalProteinSolver {
+public:
+  // Start with the foods of a table, whose ids are their positions in
+  // it, and a budget of total_kcal, which must be non-negative.
+  IncrementalProteinSolver(const FoodTable& foods, int total_kcal)
+    : _total_kcal(total_kcal),
+      _width(size_t(total_kcal) + 1),
+      _chain_left(0),
+      _layers(0),
+      _solved(false),
+      _best_protein(0) {
+    assert(total_kcal >= 0);
+    for (size_t i = 0; i < foods.size(); i++) {
+      _foods.push_back(Item{foods.kcal(i), foods.protein_g(i), true});
+      _base.push_back(i);
+    }
+    build_layers();
+  }
+
+  // Add a food, returning its id, which is one past the largest id
+  // handed out so far.
+  size_t add_food(int kcal, int protein_g) {
+    assert(kcal >= 0 && protein_g >= 0);
+    _foods.push_back(Item{kcal, protein_g, true});
+    _added.push_back(_foods.size() - 1);
+    edited();
+    return _foods.size() - 1;
+  }
+
+  // Remove the food with the given id, which must be present.
+  void remove_food(size_t id) {
+    assert(contains(id));
+    _foods[id].present = false;
+    auto added = std::find(_added.begin(), _added.end(), id);
+    if (added != _added.end()) {
+      _added.erase(added);
+    } else {
+      size_t position = std::lower_bound(_base.begin(), _base.end(), id) - _base.begin();
+      assert(position < _base.size() && _base[position] == id);
+      _removed.insert(std::lower_bound(_removed.begin(), _removed.end(), position), position);
+    }
+    edited();
+  }
+
+  // Return true if the food with the given id is present.
+  bool contains(size_t id) const {
+    return id < _foods.size() && _foods[id].present;
+  }
+
+  int total_kcal() const { return _total_kcal; }
+
+  // Number of foods present.
+  size_t size() const {
+    return _base.size() - _removed.size() + _added.size();
+  }
+
+  // Greatest protein achievable within the budget with the foods
+  // present.
+  int protein_g() {
+    solve();
+    return _best_protein;
+  }
+
+  // Ids of an optimal set of the foods present, in increasing order.
+  IndexVector foods() {
+    solve();
+    return _best_foods;
+  }
+
+  // Number of O(total_kcal) layers computed so far, which measures
+  // the cost of edits.
+  uint64_t layers() const { return _layers; }
+
+  // Fold every edit into a new base, in O(n total_kcal) time. This is
+  // done automatically when needed.
+  void rebuild() {
+    std::vector<size_t> base;
+    for (size_t i = 0; i < _foods.size(); i++) {
+      if (_foods[i].present) {
+	base.push_back(i);
+      }
+    }
+    _base.swap(base);
+    _removed.clear();
+    _added.clear();
+    build_layers();
+  }
+
+private:
+  struct Item {
+    int kcal, protein_g;
+    bool present;
+  };
+  typedef std::vector<int> Layer;
+
+  // Layer after extending layer with one more food.
+  Layer extend(const Layer& layer, const Item& item) {
+    _layers++;
+    Layer result(layer);
+    INSTRUMENT_COUNT(Counter::dp_cells, std::max(0, _total_kcal + 1 - item.kcal));
+    for (int c = _total_kcal; c >= item.kcal; c--) {
+      result[c] = std::max(result[c], layer[c - item.kcal] + item.protein_g);
+    }
+    return result;
+  }
+
+  void build_layers() {
+    const size_t n = _base.size();
+    _prefix.assign(n + 1, Layer(_width, 0));
+    _suffix.assign(n + 1, Layer(_width, 0));
+    for (size_t i = 0; i < n; i++) {
+      _prefix[i + 1] = extend(_prefix[i], _foods[_base[i]]);
+    }
+    for (size_t i = n; i-- > 0; ) {
+      _suffix[i] = extend(_suffix[i + 1], _foods[_base[i]]);
+    }
+    _chain.clear();
+    _chain_foods.clear();
+    _solved = false;
+  }
+
+  // The foods folded between the prefix and suffix layers: surviving
+  // base foods between the first and last removed ones, then the added
+  // foods.
+  std::vector<size_t> middle_foods() const {
+    std::vector<size_t> middle;
+    if (!_removed.empty()) {
+      size_t r = 0;
+      for (size_t i = _removed.front(); i <= _removed.back(); i++) {
+	if (r < _removed.size() && _removed[r] == i) {
+	  r++;
+	} else {
+	  middle.push_back(_base[i]);
+	}
+      }
+    }
+    middle.insert(middle.end(), _added.begin(), _added.end());
+    return middle;
+  }
+
+  void edited() {
+    _solved = false;
+    const size_t middle = (_removed.empty() ? 0 : _removed.back() - _removed.front()) + _added.size();
+    if (2 * middle > _base.size() + 1) {
+      rebuild();
+    }
+  }
+
+  void solve() {
+    if (_solved) {
+      return;
+    }
+    const size_t n = _base.size();
+    const size_t left = _removed.empty() ? n : _removed.front(),
+      right = _removed.empty() ? n : _removed.back() + 1;
+    const std::vector<size_t> middle = middle_foods();
+
+    // _chain[j] is the left layer extended with the first j middle
+    // foods; keep the layers the edits left alone
+    if (_chain.empty() || _chain_left != left) {
+      _chain.assign(1, _prefix[left]);
+      _chain_foods.clear();
+      _chain_left = left;
+    }
+    size_t kept = 0;
+    while (kept < _chain_foods.size() && kept < middle.size() &&
+	   _chain_foods[kept] == middle[kept]) {
+      kept++;
+    }
+    _chain.resize(kept + 1);
+    _chain_foods.assign(middle.begin(), middle.end());
+    for (size_t j = kept; j < middle.size(); j++) {
+      _chain.push_back(extend(_chain.back(), _foods[middle[j]]));
+    }
+    const std::vector<Layer>& chain = _chain;
+    const Layer& joined = chain.back();
+    const Layer& suffix = _suffix[right];
+    int split = 0;
+    _best_protein = -1;
+    for (int c = 0; c <= _total_kcal; c++) {
+      if (joined[c] + suffix[_total_kcal - c] > _best_protein) {
+	_best_protein = joined[c] + suffix[_total_kcal - c];
+	split = c;
+      }
+    }
+
+    // walk each layer back to see which foods were taken
+    _best_foods.clear();
+    int c = _total_kcal - split;
+    for (size_t i = right; i < n; i++) {
+      if (_suffix[i][c] != _suffix[i + 1][c]) {
+	_best_foods.push_back(_base[i]);
+	c -= _foods[_base[i]].kcal;
+      }
+    }
+    c = split;
+    for (size_t j = middle.size(); j-- > 0; ) {
+      if (chain[j + 1][c] != chain[j][c]) {
+	_best_foods.push_back(middle[j]);
+	c -= _foods[middle[j]].kcal;
+      }
+    }
+    for (size_t i = left; i-- > 0; ) {
+      if (_prefix[i + 1][c] != _prefix[i][c]) {
+	_best_foods.push_back(_base[i]);
+	c -= _foods[_base[i]].kcal;
+      }
+    }
+    std::sort(_best_foods.begin(), _best_foods.end());
+    _solved = true;
+  }
+
+  int _total_kcal;
+  size_t _width;
+  // every food ever added, by id
+  std::vector<Item> _foods;
+  // ids of the base foods, in increasing order
+  std::vector<size_t> _base;
+  // positions within _base of removed base foods, in increasing order
+  std::vector<size_t> _removed;
+  // ids of foods added since the last rebuild
+  std::vector<size_t> _added;
+  std::vector<Layer> _prefix, _suffix;
+  // _chain[0] is _prefix[_chain_left], and _chain[j + 1] extends
+  // _chain[j] with food _chain_foods[j]
+  std::vector<Layer> _chain;
+  std::vector<size_t> _chain_foods;
+  size_t _chain_left;
+  uint64_t _layers;
+  bool _solved;
+  int _best_protein;
+  IndexVector _best_foods;
+};
+
+// Counters describing the work done by one call to
+// branch_and_bound_max_protein.
+struct BranchAndBoundStats {
+  // Number of search tree nodes visited.
+  uint64_t nodes = 0;
+  // Number of subtrees cut off because their fractional bound could
+  // not beat the best set found so far.
+  uint64_t pruned = 0;
+  // Number of times a better set was found.
+  uint64_t improvements = 0;
+};
+
+// Depth-first search state for branch_and_bound_max_protein. The
+// foods are held in decreasing protein/kcal density order, with
+// prefix sums so the fractional knapsack bound of any suffix is found
+// by binary search. One search object may run any number of
+// searches, reusing its memory.
+//
+// A search may start from a known set of foods, and may be given a
+// stop function that is polled every 1024 nodes. When it returns true,
+// the search unwinds at once, and upper_bound() is the greatest
+// fractional bound of the subtrees it did not finish, so the best set
+// found so far is within upper_bound() - best_protein() of optimal.
+class BranchAndBoundSearch {
+public:
+  BranchAndBoundSearch()
+    : _kcal(nullptr),
+      _protein(nullptr),
+      _best_protein(0),
+      _open_bound(0),
+      _stopped(false),
+      _stop(nullptr),
+      _stats(nullptr) { }
+
+  BranchAndBoundSearch(const BranchAndBoundSearch&) = delete;
+  BranchAndBoundSearch& operator=(const BranchAndBoundSearch&) = delete;
+
+  // Search every subset of the given foods within total_kcal, adding
+  // to the counts in stats, and return which foods are in the best
+  // one. The result is valid until the next search. If seed is
+  // non-null, it is a set of foods within total_kcal that the search
+  // must beat. If stop is non-null, the search ends early once stop()
+  // returns true. If must_beat is positive, only sets with more protein
+  // than it are looked for, as if one with that much had been found.
+  const std::vector<bool>& run(const std::vector<int>& kcal,
+			       const std::vector<int>& protein,
+			       int total_kcal,
+			       BranchAndBoundStats& stats,
+			       const std::vector<bool>* seed = nullptr,
+			       const std::function<bool()>* stop = nullptr,
+			       int must_beat = 0) {
+    _kcal = &kcal;
+    _protein = &protein;
+    _stats = &stats;
+    _stop = stop;
+    _stopped = false;
+    _open_bound = 0;
+    _prefix_kcal.assign(kcal.size() + 1, 0);
+    _prefix_protein.assign(protein.size() + 1, 0);
+    for (size_t i = 0; i < kcal.size(); i++) {
+      _prefix_kcal[i + 1] = _prefix_kcal[i] + kcal[i];
+      _prefix_protein[i + 1] = _prefix_protein[i] + protein[i];
+    }
+    _chosen.assign(kcal.size(), false);
+    _best_chosen.assign(kcal.size(), false);
+    _best_protein = 0;
+    if (seed != nullptr) {
+      assert(seed->size() == kcal.size());
+      _best_chosen = *seed;
+      for (size_t i = 0; i < kcal.size(); i++) {
+	if ((*seed)[i]) {
+	  _best_protein += protein[i];
+	}
+      }
+    }
+    raise_bound(must_beat);
+    visit(0, total_kcal, 0);
+    return _best_chosen;
+  }
+
+  // Prune from now on as if a set with protein had been found, for
+  // instance one found elsewhere; may be called from the stop function.
+  // If the search then finds nothing better, best_protein() is protein
+  // and the result is whatever set it had found before.
+  void raise_bound(int protein) {
+    _best_protein = std::max(_best_protein, protein);
+  }
+
+  // Protein of the best set found by the last search.
+  int best_protein() const { return _best_protein; }
+
+  // Whether the last search was stopped before it finished.
+  bool stopped() const { return _stopped; }
+
+  // No set of foods within the budget of the last search has more
+  // protein than this. Equal to best_protein() if it finished.
+  int64_t upper_bound() const { return std::max<int64_t>(_best_protein, _open_bound); }
+
+private:
+  // Upper bound on the protein obtainable from foods i onwards within
+  // capacity kcal, allowing a fraction of the first food that does not
+  // fit.
+  int64_t bound(size_t i, int capacity) const {
+    // last food j such that foods i..j-1 all fit
+    auto it = std::upper_bound(_prefix_kcal.begin() + i, _prefix_kcal.end(),
+			       _prefix_kcal[i] + capacity);
+    const size_t j = (it - _prefix_kcal.begin()) - 1;
+    int64_t value = _prefix_protein[j] - _prefix_protein[i];
+    if (j < _kcal->size()) {
+      const int64_t left = capacity - (_prefix_kcal[j] - _prefix_kcal[i]);
+      value += (left * (*_protein)[j]) / (*_kcal)[j];
+    }
+    return value;
+  }
+
+  void visit(size_t i, int capacity, int protein) {
+    if (_stopped) {
+      // this subtree is left unexplored
+      _open_bound = std::max(_open_bound, protein + bound(i, capacity));
+      return;
+    }
+    _stats->nodes++;
+    if ((_stop != nullptr) && ((_stats->nodes & 1023) == 1) && (*_stop)()) {
+      _stopped = true;
+      _open_bound = std::max(_open_bound, protein + bound(i, capacity));
+      return;
+    }
+    if (protein > _best_protein) {
+      _best_protein = protein;
+      _best_chosen = _chosen;
+      _stats->improvements++;
+    }
+    if (i == _kcal->size()) {
+      return;
+    }
+    if (protein + bound(i, capacity) <= _best_protein) {
+      _stats->pruned++;
+      return;
+    }
+    const int kcal = (*_kcal)[i];
+    if (kcal <= capacity) {
+      _chosen[i] = true;
+      visit(i + 1, capacity - kcal, protein + (*_protein)[i]);
+      _chosen[i] = false;
+    }
+    visit(i + 1, capacity, protein);
+  }
+
+  const std::vector<int>* _kcal;
+  const std::vector<int>* _protein;
+  std::vector<int64_t> _prefix_kcal, _prefix_protein;
+  std::vector<bool> _chosen, _best_chosen;
+  int _best_protein;
+  int64_t _open_bound;
+  bool _stopped;
+  const std::function<bool()>* _stop;
+  BranchAndBoundStats* _stats;
+};
+
+// Memory reused between calls of branch_and_bound_max_protein: the
+// surviving foods in density order, and the search itself.
+struct BranchAndBoundWorkspace {
+  IndexVector order;
+  std::vector<int> kcal, protein;
+  BranchAndBoundSearch search;
+};
+
+// Fill workspace with the foods of the given table that could be part
+// of a set within total_kcal, those with protein and at most
+// total_kcal kcal, in decreasing protein/kcal density order: their
+// positions in order, and their kcal and protein.
+void prepare_branch_and_bound(BranchAndBoundWorkspace& workspace,
+			      const FoodTable& foods,
+			      int total_kcal) {
+	const int32_t* kcal = foods.kcal_column();
+	const int32_t* protein = foods.protein_g_column();
+	IndexVector& order = workspace.order;
+	order.clear();
+	for (size_t i = 0; i < foods.size(); i++)
+	{
+		if (protein[i] > 0 && kcal[i] <= total_kcal)
+			order.push_back(i);
+	}
+	// decreasing protein/kcal, compared by cross-multiplying so that
+	// zero-kcal foods come first
+	std::sort(order.begin(), order.end(),
+		  [&](size_t a, size_t b) {
+			  const int64_t lhs = int64_t(protein[a]) * kcal[b],
+				  rhs = int64_t(protein[b]) * kcal[a];
+			  return (lhs > rhs) || (lhs == rhs && a < b);
+		  });
+
+	const size_t m = order.size();
+	workspace.kcal.resize(m);
+	workspace.protein.resize(m);
+	for (size_t i = 0; i < m; i++)
+	{
+		workspace.kcal[i] = kcal[order[i]];
+		workspace.protein[i] = protein[order[i]];
+	}
+}
+
+// Compute the optimal set of foods exactly with branch and bound.
+// Foods with no protein, or too many kcal to ever fit, are dropped,
+// and the rest are sorted by decreasing protein/kcal density. A
+// depth-first search then tries including and excluding each food in
+// that order, pruning any subtree whose fractional knapsack bound
+// cannot beat the best set found so far. The worst case is still
+// exponential, but on real inputs very few subtrees survive. If stats
+// is non-null, it receives the node and prune counts of the search.
+// Returns the positions of the chosen foods in increasing order.
+//
+// This version stores the positions in result and searches in
+// workspace, reusing the memory of both, so it does not allocate once
+// they are big enough.
+void branch_and_bound_max_protein(IndexVector& result,
+				  const FoodTable& foods,
+				  int total_kcal,
+				  BranchAndBoundWorkspace& workspace,
+				  BranchAndBoundStats* stats = nullptr) {
+	INSTRUMENT_SCOPE(Phase::branch_and_bound);
+	result.clear();
+	BranchAndBoundStats local_stats;
+	if (stats == nullptr)
+		stats = &local_stats;
+	*stats = BranchAndBoundStats();
+	if (total_kcal < 0)
+		return;
+
+	prepare_branch_and_bound(workspace, foods, total_kcal);
+	const IndexVector& order = workspace.order;
+	const size_t m = order.size();
+	const std::vector<bool>& chosen =
+		workspace.search.run(workspace.kcal, workspace.protein, total_kcal, *stats);
+	INSTRUMENT_COUNT(Counter::search_nodes, stats->nodes);
+	INSTRUMENT_COUNT(Counter::search_pruned, stats->pruned);
+
+	for (size_t i = 0; i < m; i++)
+	{
+		if (chosen[i])
+			result.push_back(order[i]);
+	}
+	std::sort(result.begin(), result.end());
+}
+
+// Same as above, returning a new vector.
+IndexVector branch_and_bound_max_protein(const FoodTable& foods,
+					 int total_kcal,
+					 BranchAndBoundStats* stats = nullptr) {
+	IndexVector result;
+	BranchAndBoundWorkspace workspace;
+	branch_and_bound_max_protein(result, foods, total_kcal, workspace, stats);
+	return result;
+}
+
+// Same as above, on a FoodVector.
+std::unique_ptr<FoodVector> branch_and_bound_max_protein(const FoodVector& foods,
+							 int total_kcal,
+							 BranchAndBoundStats* stats = nullptr) {
+	FoodTable table(foods);
+	return table.to_food_vector(branch_and_bound_max_protein(table, total_kcal, stats));
+}
+
+// Compute the same set of foods as greedy_max_protein, in
+// O(n log n) time instead of O(n^2). Foods are popped from a
+// binary heap of indices in decreasing protein order, ties going
+// to the food that comes first in the input, and each one is chosen
+// if it still fits within the total_kcal budget. Foods with no
+// protein are never chosen, since they cannot add to the total.
+// Returns the positions of the chosen foods in the order they were
+// chosen.
+//
+// This version stores the positions in result and keeps the heap in
+// heap, reusing the memory of both, so it does not allocate once they
+// are big enough.
+void heap_greedy_max_protein(IndexVector& result,
+			     const FoodTable& foods,
+			     int total_kcal,
+			     IndexVector& heap) {
+	INSTRUMENT_SCOPE(Phase::heap_greedy);
+	const int32_t* kcal = foods.kcal_column();
+	const int32_t* protein = foods.protein_g_column();
+	auto lower_priority = [&](size_t a, size_t b) {
+		return (protein[a] < protein[b]) ||
+		       (protein[a] == protein[b] && a > b);
+	};
+	heap.clear();
+	for (size_t i = 0; i < foods.size(); i++)
+	{
+		if (protein[i] > 0)
+			heap.push_back(i);
+	}
+	std::make_heap(heap.begin(), heap.end(), lower_priority);
+
+	result.clear();
+	int result_cal = 0;
+	while (!heap.empty())
+	{
+		std::pop_heap(heap.begin(), heap.end(), lower_priority);
+		const size_t i = heap.back();
+		heap.pop_back();
+		if (result_cal + kcal[i] <= total_kcal)
+		{
+			result.push_back(i);
+			result_cal += kcal[i];
+		}
+	}
+}
+
+// Same as above, returning a new vector.
+IndexVector heap_greedy_max_protein(const FoodTable& foods,
+				    int total_kcal) {
+	IndexVector result, heap;
+	heap_greedy_max_protein(result, foods, total_kcal, heap);
+	return result;
+}
+
+// Same as above, on a FoodVector.
+std::unique_ptr<FoodVector> heap_greedy_max_protein(const FoodVector& foods,
+						    int total_kcal) {
+	FoodTable table(foods);
+	return table.to_food_vector(heap_greedy_max_protein(table, total_kcal));
+}
+
+// The solvers that run on a FoodTable, for callers that choose one at
+// run time.
+enum class Solver {
+  heap_greedy,
+  gray_code,
+  parallel_gray_code,
+  meet_in_middle,
+  dp,
+  branch_and_bound
+};
+
+// Human-readable name of a solver, which is also the name of its
+// function without the _max_protein suffix.
+const char* solver_name(Solver solver) {
+  switch (solver) {
+  case Solver::heap_greedy: return "heap_greedy";
+  case Solver::gray_code: return "gray_code";
+  case Solver::parallel_gray_code: return "parallel_gray_code";
+  case Solver::meet_in_middle: return "meet_in_middle";
+  case Solver::dp: return "dp";
+  case Solver::branch_and_bound: return "branch_and_bound";
+  }
+  return "unknown";
+}
+
+// Memory reused by solve_max_protein between queries. After a few
+// queries as large as any that follow, solving with the same context
+// does not allocate at all, except that parallel_gray_code still
+// starts its threads. A context must not be used by two threads at
+// once; give each thread its own.
+struct SolverContext {
+  IndexVector heap;
+  ProteinCurve curve;
+  MeetInMiddleWorkspace meet_in_middle;
+  BranchAndBoundWorkspace branch_and_bound;
+};
+
+// Run the given solver on foods with a total_kcal budget, with its
+// default options.
+IndexVector solve_max_protein(const FoodTable& foods,
+			      int total_kcal,
+			      Solver solver) {
+  switch (solver) {
+  case Solver::heap_greedy:
+    return heap_greedy_max_protein(foods, total_kcal);
+  case Solver::gray_code:
+    return gray_code_max_protein(foods, total_kcal);
+  case Solver::parallel_gray_code:
+    return parallel_gray_code_max_protein(foods, total_kcal);
+  case Solver::meet_in_middle:
+    return meet_in_middle_max_protein(foods, total_kcal);
+  case Solver::dp:
+    return dp_max_protein(foods, total_kcal);
+  case Solver::branch_and_bound:
+    return branch_and_bound_max_protein(foods, total_kcal);
+  }
+  assert(false);
+  return IndexVector();
+}
+
+// Same as above, storing the positions in result and reusing the
+// memory of result and context.
+void solve_max_protein(IndexVector& result,
+		       const FoodTable& foods,
+		       int total_kcal,
+		       Solver solver,
+		       SolverContext& context) {
+  switch (solver) {
+  case Solver::heap_greedy:
+    heap_greedy_max_protein(result, foods, total_kcal, context.heap);
+    return;
+  case Solver::gray_code:
+    gray_code_max_protein(result, foods, total_kcal);
+    return;
+  case Solver::parallel_gray_code:
+    result = parallel_gray_code_max_protein(foods, total_kcal);
+    return;
+  case Solver::meet_in_middle:
+    meet_in_middle_max_protein(result, foods, total_kcal, context.meet_in_middle);
+    return;
+  case Solver::dp:
+    dp_max_protein(result, foods, total_kcal, context.curve);
+    return;
+  case Solver::branch_and_bound:
+    branch_and_bound_max_protein(result, foods, total_kcal, context.branch_and_bound);
+    return;
+  }
+  assert(false);
+}
+
+// How many foods prune_dominated_foods removed, and why. Each removed
+// food is counted once, under the first reason that applies.
+struct PruneReport {
+  size_t input = 0;
+  // no protein, so it cannot raise any total
+  size_t zero_protein = 0;
+  // more kcal than the whole budget, so it never fits
+  size_t over_budget = 0;
+  // same kcal and protein as at least max_count other foods
+  size_t duplicate = 0;
+  // at least max_count other foods have no more kcal and no less
+  // protein, so at least one of them is always free to take its place
+  size_t dominated = 0;
+  size_t kept = 0;
+  // the most foods any solution within the budget can hold
+  size_t max_count = 0;
+};
+
+// Return the positions, in increasing order, of the foods that an exact
+// solver for total_kcal still needs to see: some optimal solution over
+// the whole table uses only these foods, so solving them alone gives
+// the same protein total.
+//
+// Foods are ordered by increasing kcal, then decreasing protein, then
+// position; a food dominates every later food with no more protein.
+// No solution holds more than max_count foods, the number of the
+// cheapest foods that fit together. So if a food has max_count
+// dominators, any solution that uses it leaves one of them out and can
+// swap it in, and the food is removed. Counting dominators takes a
+// Fenwick tree over protein values, for O(n log n) time.
+//
+// If report is non-null, stores how many foods were removed and why.
+IndexVector prune_dominated_foods(const FoodTable& foods,
+				  int total_kcal,
+				  PruneReport* report = nullptr) {
+	PruneReport local_report;
+	if (report == nullptr)
+		report = &local_report;
+	*report = PruneReport();
+	report->input = foods.size();
+
+	const int32_t* kcal = foods.kcal_column();
+	const int32_t* protein = foods.protein_g_column();
+	IndexVector order;
+	order.reserve(foods.size());
+	for (size_t i = 0; i < foods.size(); i++)
+	{
+		if (protein[i] <= 0)
+			report->zero_protein++;
+		else if (kcal[i] > total_kcal)
+			report->over_budget++;
+		else
+			order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		if (kcal[a] != kcal[b])
+			return kcal[a] < kcal[b];
+		if (protein[a] != protein[b])
+			return protein[a] > protein[b];
+		return a < b;
+	});
+
+	// the cheapest foods come first in order
+	int64_t cheapest = 0;
+	for (size_t i : order)
+	{
+		cheapest += kcal[i];
+		if (cheapest > total_kcal)
+			break;
+		report->max_count++;
+	}
+
+	// rank[i] is the number of distinct protein values greater than
+	// protein[order[i]], so a food's dominators so far are the earlier
+	// foods with rank at most its own
+	std::vector<int32_t> values;
+	values.reserve(order.size());
+	for (size_t i : order)
+		values.push_back(protein[i]);
+	std::sort(values.begin(), values.end(), std::greater<int32_t>());
+	values.erase(std::unique(values.begin(), values.end()), values.end());
+	std::vector<size_t> tree(values.size() + 1, 0);
+
+	IndexVector kept;
+	for (size_t k = 0; k < order.size(); k++)
+	{
+		const size_t i = order[k];
+		const size_t rank = std::lower_bound(values.begin(), values.end(), protein[i],
+						     std::greater<int32_t>()) - values.begin();
+		size_t dominators = 0;
+		for (size_t r = rank + 1; r > 0; r -= r & -r)
+			dominators += tree[r];
+		for (size_t r = rank + 1; r < tree.size(); r += r & -r)
+			tree[r]++;
+
+		if (dominators < report->max_count)
+			kept.push_back(i);
+		else if (kcal[order[k - 1]] == kcal[i] && protein[order[k - 1]] == protein[i])
+			report->duplicate++;
+		else
+			report->dominated++;
+	}
+	std::sort(kept.begin(), kept.end());
+	report->kept = kept.size();
+	return kept;
+}
+
+// Solve foods with the given solver after removing the foods that
+// prune_dominated_foods finds unneeded, which shrinks n, and with it the
+// 2^n cost of the exhaustive solvers. Returns positions in foods. If
+// report is non-null, stores what was pruned.
+IndexVector pruned_max_protein(const FoodTable& foods,
+			       int total_kcal,
+			       Solver solver,
+			       PruneReport* report = nullptr) {
+	const IndexVector kept = prune_dominated_foods(foods, total_kcal, report);
+	IndexVector result = solve_max_protein(foods.subset(kept), total_kcal, solver);
+	for (size_t& i : result)
+		i = kept[i];
 	return result;
 }
@@ -0,0 +1,242 @@
+///////////////////////////////////////////////////////////////////////////////
+// maxprotein_bench.cc
+//
+// Benchmark every solver over a sweep of food counts and budgets.
+//
+// For each solver, n and budget, the first n foods of ABBREV.txt with
+// 1 to 2500 kcal are solved a few times to warm up, then timed over
+// repeated trials. Each row reports the median and 95th percentile
+// time of a trial, the heap allocations one trial makes, and the
+// protein the solver found next to the optimum from dp_max_protein.
+// The results are printed as a table and written as CSV and JSON, so
+// two runs can be compared to catch regressions.
+//
+// usage: maxprotein_bench [--quick] [--trials N] [--warmup N]
+//                         [--csv PATH] [--json PATH]
+//
+// --quick sweeps only small n, for a smoke test.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "anytime.hh"
+#include "countingalloc.hh"
+#include "maxprotein.hh"
+#include "timer.hh"
+
+using namespace std;
+
+// One way of solving, and the largest n it is run on.
+struct Engine {
+  string name;
+  size_t max_n;
+  // returns the protein total of the chosen foods
+  function<int(const FoodVector&, const FoodTable&, int)> solve;
+};
+
+// One line of the results.
+struct Row {
+  string engine;
+  size_t n;
+  int total_kcal;
+  int trials;
+  double median_s, p95_s;
+  uint64_t allocations;
+  int protein_g, optimum_g;
+};
+
+int protein_of(const FoodTable& table, const IndexVector& indices) {
+  int kcal, protein;
+  sum_food_table(kcal, protein, table, indices);
+  return protein;
+}
+
+int protein_of(const unique_ptr<FoodVector>& foods) {
+  int kcal, protein;
+  sum_food_vector(kcal, protein, *foods);
+  return protein;
+}
+
+vector<Engine> all_engines() {
+  vector<Engine> engines;
+  engines.push_back(Engine{"greedy", 1000, [](const FoodVector& foods, const FoodTable&, int budget) {
+	return protein_of(greedy_max_protein(foods, budget));
+      }});
+  engines.push_back(Engine{"exhaustive", 16, [](const FoodVector& foods, const FoodTable&, int budget) {
+	return protein_of(exhaustive_max_protein(foods, budget));
+      }});
+  engines.push_back(Engine{"exhaustive/table", 16, [](const FoodVector&, const FoodTable& table, int budget) {
+	return protein_of(table, exhaustive_max_protein(table, budget));
+      }});
+  // (max n of each Solver)
+  const pair<Solver, size_t> solvers[] = {
+    {Solver::heap_greedy, SIZE_MAX},
+    {Solver::gray_code, 25},
+    {Solver::parallel_gray_code, 25},
+    {Solver::meet_in_middle, 40},
+    {Solver::dp, SIZE_MAX},
+    {Solver::branch_and_bound, SIZE_MAX},
+  };
+  for (auto& solver : solvers) {
+    Solver s = solver.first;
+    engines.push_back(Engine{solver_name(s), solver.second,
+	  [s](const FoodVector&, const FoodTable& table, int budget) {
+	    return protein_of(table, solve_max_protein(table, budget, s));
+	  }});
+  }
+  // the allocation-free path, reusing one context between trials
+  shared_ptr<SolverContext> context(new SolverContext);
+  shared_ptr<IndexVector> result(new IndexVector);
+  for (Solver s : {Solver::dp, Solver::branch_and_bound}) {
+    engines.push_back(Engine{string(solver_name(s)) + "/context", SIZE_MAX,
+	  [=](const FoodVector&, const FoodTable& table, int budget) {
+	    solve_max_protein(*result, table, budget, s, *context);
+	    return protein_of(table, *result);
+	  }});
+  }
+  engines.push_back(Engine{"fptas/0.1", SIZE_MAX, [](const FoodVector&, const FoodTable& table, int budget) {
+	return protein_of(table, fptas_max_protein(table, budget, 0.1));
+      }});
+  engines.push_back(Engine{"anytime/10ms", SIZE_MAX, [](const FoodVector&, const FoodTable& table, int budget) {
+	return anytime_max_protein(table, budget, 0.010).protein_g;
+      }});
+  return engines;
+}
+
+// Nearest-rank percentile of sorted values.
+double percentile(const vector<double>& sorted, double fraction) {
+  size_t rank = size_t(fraction * sorted.size() + 0.999999);
+  rank = max<size_t>(rank, 1);
+  return sorted[min(rank, sorted.size()) - 1];
+}
+
+Row run(const Engine& engine,
+	const FoodVector& foods,
+	const FoodTable& table,
+	int total_kcal,
+	int optimum,
+	int warmup,
+	int trials) {
+  Row row{engine.name, foods.size(), total_kcal, 0, 0, 0, 0, 0, optimum};
+  Timer timer;
+  for (int i = 0; i < warmup; i++) {
+    engine.solve(foods, table, total_kcal);
+  }
+  // keep a slow case from taking more than a few seconds
+  if (warmup > 0 && timer.elapsed() / warmup > 0.25) {
+    trials = min(trials, 3);
+  }
+  vector<double> times;
+  for (int i = 0; i < trials; i++) {
+    const uint64_t before = allocation_count;
+    timer.reset();
+    row.protein_g = engine.solve(foods, table, total_kcal);
+    times.push_back(timer.elapsed());
+    row.allocations = allocation_count - before;
+  }
+  sort(times.begin(), times.end());
+  row.trials = trials;
+  row.median_s = percentile(times, 0.5);
+  row.p95_s = percentile(times, 0.95);
+  return row;
+}
+
+void write_csv(const vector<Row>& rows, const string& path) {
+  ofstream f(path);
+  f << "engine,n,total_kcal,trials,median_s,p95_s,allocations,protein_g,optimum_g" << endl;
+  f << setprecision(9);
+  for (auto& row : rows) {
+    f << row.engine << ',' << row.n << ',' << row.total_kcal << ',' << row.trials << ','
+      << row.median_s << ',' << row.p95_s << ',' << row.allocations << ','
+      << row.protein_g << ',' << row.optimum_g << endl;
+  }
+}
+
+void write_json(const vector<Row>& rows, const string& path) {
+  ofstream f(path);
+  f << setprecision(9) << "[" << endl;
+  for (size_t i = 0; i < rows.size(); i++) {
+    auto& row = rows[i];
+    f << "  {\"engine\": \"" << row.engine << "\", \"n\": " << row.n
+      << ", \"total_kcal\": " << row.total_kcal << ", \"trials\": " << row.trials
+      << ", \"median_s\": " << row.median_s << ", \"p95_s\": " << row.p95_s
+      << ", \"allocations\": " << row.allocations << ", \"protein_g\": " << row.protein_g
+      << ", \"optimum_g\": " << row.optimum_g << "}"
+      << ((i + 1 < rows.size()) ? "," : "") << endl;
+  }
+  f << "]" << endl;
+}
+
+int main(int argc, char* argv[]) {
+  bool quick = false;
+  int trials = 11, warmup = 2;
+  string csv_path = "bench.csv", json_path = "bench.json";
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--quick") {
+      quick = true;
+    } else if (arg == "--trials" && i + 1 < argc) {
+      trials = max(1, atoi(argv[++i]));
+    } else if (arg == "--warmup" && i + 1 < argc) {
+      warmup = max(0, atoi(argv[++i]));
+    } else if (arg == "--csv" && i + 1 < argc) {
+      csv_path = argv[++i];
+    } else if (arg == "--json" && i + 1 < argc) {
+      json_path = argv[++i];
+    } else {
+      cerr << "usage: " << argv[0] << " [--quick] [--trials N] [--warmup N]"
+	   << " [--csv PATH] [--json PATH]" << endl;
+      return 1;
+    }
+  }
+
+  auto all_foods = load_usda_abbrev("ABBREV.txt");
+  if (!all_foods) {
+    cerr << "error: could not load ABBREV.txt" << endl;
+    return 1;
+  }
+  auto candidates = filter_food_vector(*all_foods, 1, 2500, all_foods->size());
+
+  vector<size_t> sizes = {5, 10, 15, 20, 25, 40, 100, 1000, candidates->size()};
+  if (quick) {
+    sizes = {5, 10, 15};
+  }
+  const vector<int> budgets = {500, 2000, 5000};
+  const vector<Engine> engines = all_engines();
+
+  cout << left << setw(24) << "engine" << right << setw(6) << "n" << setw(8) << "kcal"
+       << setw(13) << "median_s" << setw(13) << "p95_s" << setw(8) << "allocs"
+       << setw(9) << "protein" << setw(9) << "optimum" << endl;
+  vector<Row> rows;
+  for (size_t n : sizes) {
+    auto foods = filter_food_vector(*candidates, 1, 2500, n);
+    FoodTable table(*foods);
+    for (int budget : budgets) {
+      const int optimum = protein_of(table, dp_max_protein(table, budget));
+      for (auto& engine : engines) {
+	if (foods->size() > engine.max_n) {
+	  continue;
+	}
+	Row row = run(engine, *foods, table, budget, optimum, warmup, trials);
+	rows.push_back(row);
+	cout << left << setw(24) << row.engine << right << setw(6) << row.n
+	     << setw(8) << row.total_kcal << setw(13) << row.median_s
+	     << setw(13) << row.p95_s << setw(8) << row.allocations
+	     << setw(9) << row.protein_g << setw(9) << row.optimum_g << endl;
+      }
+    }
+  }
+
+  write_csv(rows, csv_path);
+  write_json(rows, json_path);
+  cout << "wrote " << rows.size() << " results to " << csv_path << " and " << json_path << endl;
+  return 0;
+}
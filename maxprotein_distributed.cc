@@ -0,0 +1,87 @@
+///////////////////////////////////////////////////////////////////////////////
+// maxprotein_distributed.cc
+//
+// Coordinator and worker of distributed.hh. As a worker, serve one
+// coordinator on standard input and output. As the coordinator, search
+// the first FOODS foods of 1 to 2500 kcal in an ABBREV file on one
+// worker per command, resuming from CHECKPOINT if it holds a checkpoint
+// of the same job, and print the best set.
+//
+// usage: maxprotein_distributed worker
+//        maxprotein_distributed exhaustive|branch_and_bound ABBREV.txt FOODS KCAL CHECKPOINT COMMAND...
+//
+// for instance, all on one line,
+//
+//        maxprotein_distributed exhaustive ABBREV.txt 40 2000 job.checkpoint
+//          "ssh a maxprotein_distributed worker" "ssh b maxprotein_distributed worker"
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdlib>
+
+#include "distributed.hh"
+#include "maxprotein.hh"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+  if (argc == 2 && string(argv[1]) == "worker") {
+    return run_distributed_worker();
+  }
+
+  if (argc < 7 || (string(argv[1]) != "exhaustive" && string(argv[1]) != "branch_and_bound")) {
+    cerr << "usage: " << argv[0] << " worker" << endl
+	 << "       " << argv[0]
+	 << " exhaustive|branch_and_bound ABBREV.txt FOODS KCAL CHECKPOINT COMMAND..." << endl;
+    return 1;
+  }
+  const DistributedKind kind =
+    (string(argv[1]) == "exhaustive") ? DistributedKind::exhaustive : DistributedKind::branch_and_bound;
+  const string source_path = argv[2];
+  const int size = atoi(argv[3]), total_kcal = atoi(argv[4]);
+  const string checkpoint_path = argv[5];
+  const vector<string> commands(argv + 6, argv + argc);
+
+  auto foods = load_usda_abbrev_mapped(source_path);
+  if (!foods) {
+    cerr << "error: could not load " << source_path << endl;
+    return 1;
+  }
+  FoodTable table = foods->subset(FoodIndex(*foods).filter(1, 2500, size));
+  if (total_kcal < 0 || (kind == DistributedKind::exhaustive && table.size() >= 64)) {
+    cerr << "error: the exhaustive search takes fewer than 64 foods and a budget of 0 or more" << endl;
+    return 1;
+  }
+
+  DistributedSearch search(table, total_kcal, kind);
+  SnapshotStatus status;
+  if (search.resume(checkpoint_path, &status)) {
+    cout << "resumed with " << search.units_done() << " of " << search.unit_count()
+	 << " units done" << endl;
+  } else if (status == SnapshotStatus::stale || status == SnapshotStatus::corrupt) {
+    cerr << "error: " << checkpoint_path << " is not a checkpoint of this job" << endl;
+    return 1;
+  }
+
+  size_t checkpoint_failures;
+  const bool finished = run_distributed_search(search, commands, checkpoint_path,
+					       DISTRIBUTED_CHECKPOINT_SECONDS, &checkpoint_failures);
+  if (checkpoint_failures > 0) {
+    cerr << "warning: " << checkpoint_failures << " of the saves to " << checkpoint_path
+	 << " failed, so a rerun may repeat work" << endl;
+  }
+  if (!finished) {
+    cerr << "error: every worker was lost with " << search.unit_count() - search.units_done()
+	 << " of " << search.unit_count() << " units left; run again to resume" << endl;
+    return 1;
+  }
+
+  IndexVector plan = search.foods();
+  int kcal, protein;
+  sum_food_table(kcal, protein, table, plan);
+  cout << plan.size() << " foods, " << kcal << " kcal, " << protein << " g protein" << endl;
+  for (size_t i : plan) {
+    cout << "  " << table.description(i).str() << endl;
+  }
+  return 0;
+}
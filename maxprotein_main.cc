@@ -17,19 +17,30 @@ int main() {
 //int n = 20;
 int n = 25;
 
-  auto source = load_usda_abbrev("ABBREV.txt");
-  auto foods = filter_food_vector(*source, min_kcal, max_kcal, n);
+  // only reads as far into the file as the first n matching foods
+  auto foods = load_filtered_usda_abbrev("ABBREV.txt", min_kcal, max_kcal, n);
 
   Timer timer;
-  // make sure to swap exhaustive_max_protein with greedy_max_protein
-  auto result = exhaustive_max_protein(*foods, total_kcal);
+  // make sure to swap gray_code_max_protein with greedy_max_protein
+  // or the reference exhaustive_max_protein
+  auto result = gray_code_max_protein(*foods, total_kcal);
 
   double elapsed = timer.elapsed();
 
-  cout << "exhaustive_max_protein" << endl;
+  cout << "gray_code_max_protein" << endl;
   cout << "n = " << n << endl;
   cout << "elapsed time=" << elapsed << " seconds" << endl;
 
+  // the same search spread over every hardware thread
+  timer.reset();
+  auto parallel_result = parallel_gray_code_max_protein(*foods, total_kcal);
+  double parallel_elapsed = timer.elapsed();
+  assert(*parallel_result == *result);
+
+  cout << "parallel_gray_code_max_protein" << endl;
+  cout << "threads = " << thread::hardware_concurrency() << endl;
+  cout << "elapsed time=" << parallel_elapsed << " seconds" << endl;
+
   // printing out the sum
   // to see how close the greedy/exhaustive search was to total_kcal
   int sum = 0;
@@ -39,5 +50,10 @@ int n = 25;
   }
   cout << "sum = " << sum << endl;
 
+  // where the time went, when built with -DMAXPROTEIN_INSTRUMENT
+  if (INSTRUMENT_ENABLED) {
+    instrument_dump(cout);
+  }
+
   return 0;
 }
@@ -0,0 +1,55 @@
+///////////////////////////////////////////////////////////////////////////////
+// maxprotein_snapshot.cc
+//
+// Convert a USDA ABBREV file to a binary snapshot that
+// load_usda_abbrev_snapshot can map without parsing, and solve the
+// standard catalog, the foods of 1 to 2500 kcal, for every budget up
+// to 5000 kcal into a curve snapshot for load_curve_snapshot.
+//
+// usage: maxprotein_snapshot [ABBREV.txt [ABBREV.snapshot [ABBREV.curve]]]
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "curvesnapshot.hh"
+#include "maxprotein.hh"
+#include "snapshot.hh"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+  string source_path = (argc > 1) ? argv[1] : "ABBREV.txt";
+  string snapshot_path = (argc > 2) ? argv[2] : "ABBREV.snapshot";
+  string curve_path = (argc > 3) ? argv[3] : "ABBREV.curve";
+
+  auto foods = load_usda_abbrev_mapped(source_path);
+  if (!foods) {
+    cerr << "error: could not load " << source_path << endl;
+    return 1;
+  }
+
+  if (!write_food_snapshot(*foods, snapshot_path, source_path)) {
+    cerr << "error: could not write " << snapshot_path << endl;
+    return 1;
+  }
+
+  // make sure the snapshot reads back
+  SnapshotStatus status;
+  auto check = load_food_snapshot(snapshot_path, source_path, &status);
+  if (!check || check->size() != foods->size()) {
+    cerr << "error: " << snapshot_path << " does not read back" << endl;
+    return 1;
+  }
+
+  cout << "wrote " << foods->size() << " foods to " << snapshot_path << endl;
+
+  const int max_kcal = 5000;
+  FoodTable catalog = foods->subset(FoodIndex(*foods).filter(1, 2500, foods->size()));
+  if (!write_curve_snapshot(catalog, max_kcal, curve_path) ||
+      !load_curve_snapshot(curve_path, catalog)) {
+    cerr << "error: could not write " << curve_path << endl;
+    return 1;
+  }
+  cout << "wrote answers for " << catalog.size() << " foods and budgets 0 through "
+       << max_kcal << " kcal to " << curve_path << endl;
+  return 0;
+}
@@ -5,12 +5,29 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
+// test the instrumentation too
+#ifndef MAXPROTEIN_INSTRUMENT
+#define MAXPROTEIN_INSTRUMENT
+#endif
 
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
 #include <sstream>
 
+#include "accelerator.hh"
+#include "anytime.hh"
+#include "async.hh"
+#include "batch.hh"
+#include "countingalloc.hh"
+#include "curvesnapshot.hh"
+#include "distributed.hh"
 #include "maxprotein.hh"
+#include "nutrients.hh"
 #include "rubrictest.hh"
+#include "servings.hh"
+#include "snapshot.hh"
+#include "solvecache.hh"
 
 int main() {
   Rubric rubric;
@@ -23,6 +40,12 @@ int main() {
   assert( all_foods );
 
   auto filtered_foods = filter_food_vector(*all_foods, 1, 2500, all_foods->size());
+
+  // optimal protein for the first n foods under 2000 kcal, n=2..18
+  std::vector<int> optimal_protein_totals = {
+    1, 1, 22, 45, 66, 85, 110, 113, 115, 118, 127, 135, 136,
+    141, 149, 149, 151,
+  };
   
   rubric.criterion("load_usda_abbrev still works", 2,
 		   [&]() {
@@ -30,6 +53,98 @@ int main() {
 		     TEST_EQUAL("size", 8490, all_foods->size());
 		   });
   
+  rubric.criterion("FoodIndex", 2,
+		   [&]() {
+		     FoodIndex index(*all_foods);
+		     TEST_EQUAL("size", all_foods->size(), index.size());
+		     auto ten = filter_food_vector(*all_foods, index, 1, 2000, 10);
+		     TEST_EQUAL("total_size", 10, ten->size());
+		     TEST_EQUAL("contents", "BUTTER,WITH SALT", (*ten)[0]->description());
+		     TEST_EQUAL("contents", "CHEESE,CHESHIRE", (*ten)[9]->description());
+
+		     FoodTable table(*all_foods);
+		     FoodIndex table_index(table);
+		     const int windows[][2] = {
+		       {0, 0}, {0, 10}, {1, 2000}, {100, 150}, {717, 717},
+		       {500, 400}, {2500, 100000}, {-5, 3},
+		     };
+		     for (auto& window : windows) {
+		       for (int total_size : {0, 1, 3, 50, 100000}) {
+			 auto expected = filter_food_vector(*all_foods, window[0], window[1], total_size),
+			   actual = filter_food_vector(*all_foods, index, window[0], window[1], total_size);
+			 TEST_TRUE("same foods", *expected == *actual);
+			 auto positions = table_index.filter(window[0], window[1], total_size);
+			 TEST_TRUE("same foods", *expected == *table.to_food_vector(positions));
+		       }
+		     }
+		   });
+
+  rubric.criterion("load_filtered_usda_abbrev", 2,
+		   [&]() {
+		     for (int total_size : {0, 1, 25, 100000}) {
+		       for (int max_kcal : {100, 2000}) {
+			 auto expected = filter_food_vector(*all_foods, 1, max_kcal, total_size);
+			 auto actual = load_filtered_usda_abbrev("ABBREV.txt", 1, max_kcal, total_size);
+			 TEST_TRUE("non-null", actual);
+			 TEST_EQUAL("size", expected->size(), actual->size());
+			 for (size_t i = 0; i < actual->size(); i++) {
+			   TEST_EQUAL("description", (*expected)[i]->description(), (*actual)[i]->description());
+			   TEST_EQUAL("amount", (*expected)[i]->amount(), (*actual)[i]->amount());
+			   TEST_EQUAL("kcal", (*expected)[i]->kcal(), (*actual)[i]->kcal());
+			   TEST_EQUAL("protein_g", (*expected)[i]->protein_g(), (*actual)[i]->protein_g());
+			 }
+		       }
+		     }
+
+		     auto butter = load_usda_abbrev_if("ABBREV.txt",
+						       [](const AbbrevRecord& record) {
+							 return record.description == "BUTTER OIL,ANHYDROUS";
+						       },
+						       1);
+		     TEST_EQUAL("predicate", 1, butter->size());
+		     TEST_EQUAL("predicate", "BUTTER OIL,ANHYDROUS", (*butter)[0]->description());
+		     TEST_FALSE("missing file", load_filtered_usda_abbrev("no such file", 1, 2000, 10));
+		   });
+
+  rubric.criterion("parse_abbrev_line", 2,
+		   [&]() {
+		     auto number = [](const std::string& field) {
+		       int output = -1;
+		       return parse_abbrev_number(output, field.data(), field.data() + field.size())
+			 ? output : -1;
+		     };
+		     TEST_EQUAL("integer", 717, number("717"));
+		     TEST_EQUAL("round down", 0, number("0.49"));
+		     TEST_EQUAL("round up", 1, number("0.5"));
+		     TEST_EQUAL("no fraction digits", 3, number("3."));
+		     TEST_EQUAL("exponent", 1200, number("1.2e3"));
+		     TEST_EQUAL("empty", -1, number(""));
+		     TEST_EQUAL("not a number", -1, number("~1 cup~"));
+
+		     std::string line = "~01001~^~BUTTER,WITH SALT~^15.87^717^0.85";
+		     for (int i = 5; i < 48; i++) {
+		       line += "^0";
+		     }
+		     AbbrevRecord record;
+		     std::string food = line + "^5.0^~1 pat~^14.2^~1 tbsp~^0\r";
+		     TEST_TRUE("food", AbbrevLine::food ==
+			       parse_abbrev_line(record, food.data(), food.data() + food.size()));
+		     TEST_EQUAL("description", "BUTTER,WITH SALT", record.description);
+		     TEST_EQUAL("amount", "1 pat", record.amount);
+		     TEST_EQUAL("amount_g", 5, record.amount_g);
+		     TEST_EQUAL("kcal", 717, record.kcal);
+		     TEST_EQUAL("protein_g", 1, record.protein_g);
+		     TEST_EQUAL("fat_g", 0, record.fat_g);
+		     TEST_EQUAL("carb_g", 0, record.carb_g);
+		     TEST_EQUAL("sodium_mg", 0, record.sodium_mg);
+
+		     std::string no_amount = line + "^^~~^^~~^0";
+		     TEST_TRUE("skipped", AbbrevLine::skipped ==
+			       parse_abbrev_line(record, no_amount.data(), no_amount.data() + no_amount.size()));
+		     TEST_TRUE("too few fields", AbbrevLine::malformed ==
+			       parse_abbrev_line(record, line.data(), line.data() + line.size()));
+		   });
+
   rubric.criterion("filter_food_vector", 2,
 		   [&]() {
 		     auto three = filter_food_vector(*all_foods, 1, 2000, 3),
@@ -45,6 +160,195 @@ int main() {
 		     }
 		   });
 
+  rubric.criterion("FoodTable conversion", 2,
+		   [&]() {
+		     FoodTable table(*filtered_foods);
+		     TEST_EQUAL("size", filtered_foods->size(), table.size());
+		     for (size_t i = 0; i < table.size(); i++) {
+		       auto& food = (*filtered_foods)[i];
+		       TEST_EQUAL("kcal", food->kcal(), table.kcal(i));
+		       TEST_EQUAL("kcal column", food->kcal(), table.kcal_column()[i]);
+		       TEST_EQUAL("protein_g", food->protein_g(), table.protein_g(i));
+		       TEST_EQUAL("amount_g", food->amount_g(), table.amount_g(i));
+		       TEST_EQUAL("description", StringRef(food->description()), table.description(i));
+		       TEST_EQUAL("amount", StringRef(food->amount()), table.amount(i));
+		     }
+
+		     // converting back shares the original Food objects
+		     auto round_trip = table.to_food_vector();
+		     TEST_TRUE("round trip", *round_trip == *filtered_foods);
+		     auto some = table.to_food_vector(IndexVector{9, 0, 3});
+		     TEST_EQUAL("picked", 3, some->size());
+		     TEST_EQUAL("picked", (*filtered_foods)[9], (*some)[0]);
+		     TEST_EQUAL("picked", (*filtered_foods)[0], (*some)[1]);
+		     TEST_EQUAL("picked", (*filtered_foods)[3], (*some)[2]);
+
+		     // solvers return positions within the table
+		     FoodTable trivial_table(trivial_foods);
+		     TEST_TRUE("banana only", dp_max_protein(trivial_table, 100) == IndexVector{0});
+		     TEST_TRUE("hotdog only", gray_code_max_protein(trivial_table, 150) == IndexVector{1});
+		     TEST_TRUE("both", branch_and_bound_max_protein(trivial_table, 250) == (IndexVector{0, 1}));
+		     int kcal, protein;
+		     sum_food_table(kcal, protein, table, dp_max_protein(table, 2000));
+		     TEST_EQUAL("dp on table", 501, protein);
+		     TEST_LE("dp on table", kcal, 2000);
+
+		     // a subset copies the picked rows and shares the Foods
+		     FoodTable subset = table.subset(IndexVector{9, 0, 3});
+		     TEST_EQUAL("subset", 3, subset.size());
+		     TEST_EQUAL("subset", table.kcal(9), subset.kcal(0));
+		     TEST_EQUAL("subset", table.description(3), subset.description(2));
+		     TEST_EQUAL("subset", (*filtered_foods)[0], subset.food(1));
+		   });
+
+  rubric.criterion("load_usda_abbrev_mapped", 2,
+		   [&]() {
+		     auto mapped = load_usda_abbrev_mapped("ABBREV.txt");
+		     TEST_TRUE("non-null", mapped);
+		     TEST_EQUAL("size", all_foods->size(), mapped->size());
+		     for (size_t i = 0; i < mapped->size(); i++) {
+		       auto& food = (*all_foods)[i];
+		       TEST_EQUAL("description", StringRef(food->description()), mapped->description(i));
+		       TEST_EQUAL("amount", StringRef(food->amount()), mapped->amount(i));
+		       TEST_EQUAL("amount_g", food->amount_g(), mapped->amount_g(i));
+		       TEST_EQUAL("kcal", food->kcal(), mapped->kcal(i));
+		       TEST_EQUAL("protein_g", food->protein_g(), mapped->protein_g(i));
+		     }
+
+		     // copies keep the mapping alive
+		     FoodTable copy = *mapped;
+		     mapped.reset();
+		     TEST_EQUAL("copy", "BUTTER,WITH SALT", copy.description(0));
+		     auto foods = copy.to_food_vector(IndexVector{0});
+		     TEST_EQUAL("materialized", "BUTTER,WITH SALT", (*foods)[0]->description());
+		     TEST_EQUAL("materialized", (*all_foods)[0]->kcal(), (*foods)[0]->kcal());
+
+		     TEST_FALSE("missing file", load_usda_abbrev_mapped("no such file"));
+		   });
+
+  rubric.criterion("food snapshots", 2,
+		   [&]() {
+		     const std::string path = "maxprotein_test.snapshot";
+		     auto mapped = load_usda_abbrev_mapped("ABBREV.txt");
+		     TEST_TRUE("write", write_food_snapshot(*mapped, path, "ABBREV.txt"));
+
+		     SnapshotStatus status;
+		     auto snapshot = load_food_snapshot(path, "ABBREV.txt", &status);
+		     TEST_TRUE("load", snapshot);
+		     TEST_TRUE("ok", status == SnapshotStatus::ok);
+		     TEST_EQUAL("size", mapped->size(), snapshot->size());
+		     for (size_t i = 0; i < snapshot->size(); i++) {
+		       TEST_EQUAL("description", mapped->description(i), snapshot->description(i));
+		       TEST_EQUAL("amount", mapped->amount(i), snapshot->amount(i));
+		       TEST_EQUAL("amount_g", mapped->amount_g(i), snapshot->amount_g(i));
+		       TEST_EQUAL("kcal", mapped->kcal(i), snapshot->kcal(i));
+		       TEST_EQUAL("protein_g", mapped->protein_g(i), snapshot->protein_g(i));
+		     }
+		     snapshot.reset();
+
+		     // a snapshot of another file is stale
+		     TEST_FALSE("stale", load_food_snapshot(path, "maxprotein_test.cc", &status));
+		     TEST_TRUE("stale", status == SnapshotStatus::stale);
+		     auto fallback = load_usda_abbrev_snapshot("ABBREV.txt", "no such snapshot");
+		     TEST_TRUE("fallback", fallback);
+		     TEST_EQUAL("fallback", mapped->size(), fallback->size());
+
+		     // point one description past the end of the pool, with a
+		     // checksum that matches the tampering
+		     {
+		       std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+		       SnapshotHeader header;
+		       f.read(reinterpret_cast<char*>(&header), sizeof(header));
+		       std::vector<char> body(f.seekg(0, std::ios::end).tellg() -
+					      std::streamoff(sizeof(header)));
+		       f.seekg(sizeof(header));
+		       f.read(body.data(), body.size());
+		       const uint32_t offset = header.pool_size + 1000;
+		       std::memcpy(body.data() + 3 * header.food_count * sizeof(int32_t) + sizeof(uint32_t),
+				   &offset, sizeof(offset));
+		       header.checksum = fnv1a_hash(body.data(), body.size());
+		       f.seekp(0);
+		       f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		       f.write(body.data(), body.size());
+		     }
+		     TEST_FALSE("offset", load_food_snapshot(path, "ABBREV.txt", &status));
+		     TEST_TRUE("offset", status == SnapshotStatus::corrupt);
+		     TEST_TRUE("write", write_food_snapshot(*mapped, path, "ABBREV.txt"));
+		     TEST_TRUE("rewritten", load_food_snapshot(path, "ABBREV.txt", &status));
+
+		     // flip one byte of the body
+		     {
+		       std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+		       f.seekp(sizeof(SnapshotHeader) + 10);
+		       f.put('\x7f');
+		     }
+		     TEST_FALSE("corrupt", load_food_snapshot(path, "ABBREV.txt", &status));
+		     TEST_TRUE("corrupt", status == SnapshotStatus::corrupt);
+		     std::remove(path.c_str());
+		     TEST_FALSE("missing", load_food_snapshot(path, "ABBREV.txt", &status));
+		     TEST_TRUE("missing", status == SnapshotStatus::missing);
+		   });
+
+  rubric.criterion("curve snapshots", 2,
+		   [&]() {
+		     const std::string path = "maxprotein_test.curve";
+		     FoodTable catalog(*filtered_foods);
+		     TEST_TRUE("write", write_curve_snapshot(catalog, 2500, path));
+
+		     SnapshotStatus status;
+		     auto stored = load_curve_snapshot(path, catalog, &status);
+		     TEST_TRUE("load", stored);
+		     TEST_TRUE("ok", status == SnapshotStatus::ok);
+		     TEST_EQUAL("max_kcal", 2500, stored->max_kcal());
+		     ProteinCurve curve(catalog, 2500);
+		     IndexVector foods;
+		     for (int c = 0; c <= 2500; c += 50) {
+		       TEST_EQUAL("protein_g", curve.protein_g(c), stored->protein_g(c));
+		       stored->foods(foods, c);
+		       TEST_EQUAL("foods", curve.foods(c), foods);
+		       TEST_EQUAL("food_count", foods.size(), stored->food_count(c));
+		     }
+		     stored.reset();
+
+		     // a curve of other foods is stale
+		     IndexVector fewer;
+		     for (size_t i = 1; i < catalog.size(); i++) {
+		       fewer.push_back(i);
+		     }
+		     TEST_FALSE("stale", load_curve_snapshot(path, catalog.subset(fewer), &status));
+		     TEST_TRUE("stale", status == SnapshotStatus::stale);
+
+		     {
+		       // offsets past the positions, with a matching checksum
+		       std::ifstream in(path, std::ios::binary);
+		       std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		       in.close();
+		       CurveSnapshotHeader header;
+		       std::memcpy(&header, contents.data(), sizeof(header));
+		       const size_t last_offset = sizeof(header) + (2 * (header.max_kcal + 1)) * sizeof(uint32_t);
+		       const uint32_t past = header.position_count + 1000;
+		       std::memcpy(&contents[last_offset], &past, sizeof(past));
+		       header.checksum = fnv1a_hash(contents.data() + sizeof(header), contents.size() - sizeof(header));
+		       std::memcpy(&contents[0], &header, sizeof(header));
+		       std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		       out.write(contents.data(), contents.size());
+		     }
+		     TEST_FALSE("inconsistent", load_curve_snapshot(path, catalog, &status));
+		     TEST_TRUE("inconsistent", status == SnapshotStatus::corrupt);
+		     TEST_TRUE("rewrite", write_curve_snapshot(catalog, 2500, path));
+
+		     {
+		       std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+		       f.seekp(sizeof(CurveSnapshotHeader) + 10);
+		       f.put('\x7f');
+		     }
+		     TEST_FALSE("corrupt", load_curve_snapshot(path, catalog, &status));
+		     TEST_TRUE("corrupt", status == SnapshotStatus::corrupt);
+		     std::remove(path.c_str());
+		     TEST_FALSE("missing", load_curve_snapshot(path, catalog, &status));
+		     TEST_TRUE("missing", status == SnapshotStatus::missing);
+		   });
+
   rubric.criterion("greedy_max_protein trivial cases", 2,
 		   [&]() {
 		     auto soln = greedy_max_protein(trivial_foods, 99);
@@ -84,6 +388,56 @@ int main() {
 		     TEST_EQUAL("2500 kcal solution", 595, protein2500);
 		   });
 
+  rubric.criterion("heap_greedy_max_protein trivial cases", 2,
+		   [&]() {
+		     auto soln = heap_greedy_max_protein(trivial_foods, 99);
+		     TEST_TRUE("non-null", soln);
+		     TEST_TRUE("empty solution", soln->empty());
+
+		     soln = heap_greedy_max_protein(trivial_foods, 100);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("banana only", 1, soln->size());
+		     TEST_EQUAL("banana only", "banana", (*soln)[0]->description());
+
+		     soln = heap_greedy_max_protein(trivial_foods, 150);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("hotdog only", 1, soln->size());
+		     TEST_EQUAL("hotdog only", "hotdog", (*soln)[0]->description());
+
+		     soln = heap_greedy_max_protein(trivial_foods, 250);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("hotdog and banana", 2, soln->size());
+		   });
+
+  rubric.criterion("heap_greedy_max_protein correctness", 4,
+		   [&]() {
+		     for (int budget : {2000, 2500}) {
+		       auto expected = greedy_max_protein(*filtered_foods, budget),
+			 actual = heap_greedy_max_protein(*filtered_foods, budget);
+		       TEST_TRUE("non-null", actual);
+
+		       // same picks in the same order, minus zero-protein foods
+		       FoodVector expected_protein_foods;
+		       for (auto& food : *expected) {
+			 if (food->protein_g() > 0) {
+			   expected_protein_foods.push_back(food);
+			 }
+		       }
+		       TEST_EQUAL("same picks", expected_protein_foods.size(), actual->size());
+		       for (size_t i = 0; i < actual->size(); i++) {
+			 TEST_EQUAL("same picks", expected_protein_foods[i], (*actual)[i]);
+		       }
+		     }
+
+		     auto soln2000 = heap_greedy_max_protein(*filtered_foods, 2000),
+		       soln2500 = heap_greedy_max_protein(*filtered_foods, 2500);
+		     int kcal2000, protein2000, kcal2500, protein2500;
+		     sum_food_vector(kcal2000, protein2000, *soln2000);
+		     sum_food_vector(kcal2500, protein2500, *soln2500);
+		     TEST_EQUAL("2000 kcal solution", 476, protein2000);
+		     TEST_EQUAL("2500 kcal solution", 595, protein2500);
+		   });
+
   rubric.criterion("exhaustive_max_protein trivial cases", 2,
 		   [&]() {
 		     auto soln = exhaustive_max_protein(trivial_foods, 99);
@@ -107,12 +461,6 @@ int main() {
   
   rubric.criterion("exhaustive_max_protein correctness", 4,
 		   [&]() {
-
-		     std::vector<int> optimal_protein_totals = {
-		       1, 1, 22, 45, 66, 85, 110, 113, 115, 118, 127, 135, 136,
-		       141, 149, 149, 151,
-		     };
-		     
 		     for (int n = 2; n <= 18; n++) {
 		       int expected_protein = optimal_protein_totals[n-2];
 		       auto small_foods = filter_food_vector(*filtered_foods, 1, 2000, n);
@@ -129,5 +477,970 @@ int main() {
 		     }
 		   });
 
+  rubric.criterion("gray_code_max_protein trivial cases", 2,
+		   [&]() {
+		     auto soln = gray_code_max_protein(trivial_foods, 99);
+		     TEST_TRUE("non-null", soln);
+		     TEST_TRUE("empty solution", soln->empty());
+
+		     soln = gray_code_max_protein(trivial_foods, 100);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("banana only", 1, soln->size());
+		     TEST_EQUAL("banana only", "banana", (*soln)[0]->description());
+
+		     soln = gray_code_max_protein(trivial_foods, 150);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("hotdog only", 1, soln->size());
+		     TEST_EQUAL("hotdog only", "hotdog", (*soln)[0]->description());
+
+		     soln = gray_code_max_protein(trivial_foods, 250);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("hotdog and banana", 2, soln->size());
+		   });
+
+  rubric.criterion("gray_code_max_protein correctness", 4,
+		   [&]() {
+		     for (int n = 2; n <= 18; n++) {
+		       int expected_protein = optimal_protein_totals[n-2];
+		       auto small_foods = filter_food_vector(*filtered_foods, 1, 2000, n);
+		       auto solution = gray_code_max_protein(*small_foods, 2000);
+		       TEST_TRUE("non-null", solution);
+		       int actual_kcal, actual_protein;
+		       sum_food_vector(actual_kcal, actual_protein, *solution);
+		       std::stringstream ss;
+		       ss << "gray code search n=" << n
+			  << ", expected protein=" << expected_protein
+			  << " but algorithm found=" << actual_protein;
+		       TEST_EQUAL(ss.str(), expected_protein, actual_protein);
+		       TEST_LE("within budget", actual_kcal, 2000);
+
+		       // same subset as the reference implementation
+		       auto reference = exhaustive_max_protein(*small_foods, 2000);
+		       TEST_EQUAL("same subset", reference->size(), solution->size());
+		       for (size_t i = 0; i < solution->size(); i++) {
+			 TEST_EQUAL("same subset", (*reference)[i], (*solution)[i]);
+		       }
+		     }
+		   });
+
+  rubric.criterion("exhaustive_max_protein fixed-size kernels", 2,
+		   [&]() {
+		     FoodTable trivial(trivial_foods);
+		     for (int total_kcal : {-1, 99, 100, 150, 250}) {
+		       TEST_EQUAL("trivial", gray_code_max_protein(trivial, total_kcal),
+				  exhaustive_max_protein<2>(trivial, total_kcal));
+		     }
+		     TEST_TRUE("none", exhaustive_max_protein<0>(FoodTable(), 100).empty());
+		     FoodTable eight(*filter_food_vector(*filtered_foods, 1, 2000, 8)),
+		       sixteen(*filter_food_vector(*filtered_foods, 1, 2000, 16));
+		     for (int total_kcal : {0, 500, 2000, 20000}) {
+		       TEST_EQUAL("n=8", gray_code_max_protein(eight, total_kcal),
+				  exhaustive_max_protein<8>(eight, total_kcal));
+		       TEST_EQUAL("n=16", gray_code_max_protein(sixteen, total_kcal),
+				  exhaustive_max_protein<16>(sixteen, total_kcal));
+		     }
+		     // the dispatcher, on both sides of its threshold
+		     for (int n = 0; n <= 18; n++) {
+		       FoodTable small(*filter_food_vector(*filtered_foods, 1, 2000, n));
+		       TEST_EQUAL("dispatch", gray_code_max_protein(small, 2000),
+				  exhaustive_max_protein(small, 2000));
+		     }
+		   });
+
+  rubric.criterion("parallel_gray_code_max_protein matches serial", 4,
+		   [&]() {
+		     for (int threads : {1, 2, 3, 8}) {
+		       auto soln = parallel_gray_code_max_protein(trivial_foods, 99, threads);
+		       TEST_TRUE("non-null", soln);
+		       TEST_TRUE("empty solution", soln->empty());
+
+		       soln = parallel_gray_code_max_protein(trivial_foods, 250, threads);
+		       TEST_TRUE("non-null", soln);
+		       TEST_EQUAL("hotdog and banana", 2, soln->size());
+
+		       for (int n : {5, 17, 20}) {
+			 auto small_foods = filter_food_vector(*filtered_foods, 1, 2000, n);
+			 for (int budget : {0, 500, 2000}) {
+			   auto expected = gray_code_max_protein(*small_foods, budget),
+			     actual = parallel_gray_code_max_protein(*small_foods, budget, threads);
+			   TEST_TRUE("non-null", actual);
+			   TEST_EQUAL("same subset", expected->size(), actual->size());
+			   for (size_t i = 0; i < actual->size(); i++) {
+			     TEST_EQUAL("same subset", (*expected)[i], (*actual)[i]);
+			   }
+			 }
+		       }
+		     }
+		   });
+
+  rubric.criterion("subset-sum kernels agree", 4,
+		   [&]() {
+		     for (auto kernel : {SubsetSumKernel::scalar,
+					 SubsetSumKernel::avx2,
+					 SubsetSumKernel::avx512}) {
+		       if (!subset_sum_kernel_supported(kernel)) {
+			 continue;
+		       }
+		       for (int n : {2, 3, 4, 5, 12, 20}) {
+			 FoodTable table(*filter_food_vector(*filtered_foods, 1, 2000, n));
+			 for (int budget : {-1, 0, 300, 2000}) {
+			   auto expected = gray_code_max_protein(table, budget, SubsetSumKernel::scalar);
+			   TEST_TRUE("gray code", expected == gray_code_max_protein(table, budget, kernel));
+			   TEST_TRUE("parallel", expected == parallel_gray_code_max_protein(table, budget, 3, kernel));
+
+			   // meet in the middle may break ties differently
+			   int expected_kcal, expected_protein, actual_kcal, actual_protein;
+			   sum_food_table(expected_kcal, expected_protein, table, expected);
+			   sum_food_table(actual_kcal, actual_protein, table,
+					  meet_in_middle_max_protein(table, budget, kernel));
+			   TEST_EQUAL("meet in the middle", expected_protein, actual_protein);
+			   TEST_TRUE("within budget", expected.empty() || actual_kcal <= budget);
+			 }
+		       }
+		     }
+		   });
+
+  rubric.criterion("meet_in_middle_max_protein trivial cases", 2,
+		   [&]() {
+		     auto soln = meet_in_middle_max_protein(trivial_foods, 99);
+		     TEST_TRUE("non-null", soln);
+		     TEST_TRUE("empty solution", soln->empty());
+
+		     soln = meet_in_middle_max_protein(trivial_foods, 100);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("banana only", 1, soln->size());
+		     TEST_EQUAL("banana only", "banana", (*soln)[0]->description());
+
+		     soln = meet_in_middle_max_protein(trivial_foods, 150);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("hotdog only", 1, soln->size());
+		     TEST_EQUAL("hotdog only", "hotdog", (*soln)[0]->description());
+
+		     soln = meet_in_middle_max_protein(trivial_foods, 250);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("hotdog and banana", 2, soln->size());
+		   });
+
+  rubric.criterion("meet_in_middle_max_protein correctness", 4,
+		   [&]() {
+		     for (int n = 2; n <= 18; n++) {
+		       int expected_protein = optimal_protein_totals[n-2];
+		       auto small_foods = filter_food_vector(*filtered_foods, 1, 2000, n);
+		       auto solution = meet_in_middle_max_protein(*small_foods, 2000);
+		       TEST_TRUE("non-null", solution);
+		       int actual_kcal, actual_protein;
+		       sum_food_vector(actual_kcal, actual_protein, *solution);
+		       std::stringstream ss;
+		       ss << "meet in the middle n=" << n
+			  << ", expected protein=" << expected_protein
+			  << " but algorithm found=" << actual_protein;
+		       TEST_EQUAL(ss.str(), expected_protein, actual_protein);
+		       TEST_LE("within budget", actual_kcal, 2000);
+		     }
+
+		     // agrees with the Gray-code search past the table
+		     for (int n = 20; n <= 24; n += 2) {
+		       auto small_foods = filter_food_vector(*filtered_foods, 1, 2000, n);
+		       int expected_kcal, expected_protein, actual_kcal, actual_protein;
+		       sum_food_vector(expected_kcal, expected_protein,
+				       *gray_code_max_protein(*small_foods, 1500));
+		       sum_food_vector(actual_kcal, actual_protein,
+				       *meet_in_middle_max_protein(*small_foods, 1500));
+		       TEST_EQUAL("agrees with gray code", expected_protein, actual_protein);
+		       TEST_LE("within budget", actual_kcal, 1500);
+		     }
+		   });
+
+  rubric.criterion("dp_max_protein trivial cases", 2,
+		   [&]() {
+		     auto soln = dp_max_protein(trivial_foods, 99);
+		     TEST_TRUE("non-null", soln);
+		     TEST_TRUE("empty solution", soln->empty());
+
+		     soln = dp_max_protein(trivial_foods, 100);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("banana only", 1, soln->size());
+		     TEST_EQUAL("banana only", "banana", (*soln)[0]->description());
+
+		     soln = dp_max_protein(trivial_foods, 150);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("hotdog only", 1, soln->size());
+		     TEST_EQUAL("hotdog only", "hotdog", (*soln)[0]->description());
+
+		     soln = dp_max_protein(trivial_foods, 250);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("hotdog and banana", 2, soln->size());
+		   });
+
+  rubric.criterion("dp_max_protein correctness", 4,
+		   [&]() {
+		     for (int n = 2; n <= 18; n++) {
+		       int expected_protein = optimal_protein_totals[n-2];
+		       auto small_foods = filter_food_vector(*filtered_foods, 1, 2000, n);
+		       auto solution = dp_max_protein(*small_foods, 2000);
+		       TEST_TRUE("non-null", solution);
+		       int actual_kcal, actual_protein;
+		       sum_food_vector(actual_kcal, actual_protein, *solution);
+		       std::stringstream ss;
+		       ss << "dynamic programming n=" << n
+			  << ", expected protein=" << expected_protein
+			  << " but algorithm found=" << actual_protein;
+		       TEST_EQUAL(ss.str(), expected_protein, actual_protein);
+		       TEST_LE("within budget", actual_kcal, 2000);
+		     }
+
+		     // the whole database, where greedy only finds 476 and 595
+		     auto soln2000 = dp_max_protein(*filtered_foods, 2000),
+		       soln2500 = dp_max_protein(*filtered_foods, 2500);
+		     int kcal2000, protein2000, kcal2500, protein2500;
+		     sum_food_vector(kcal2000, protein2000, *soln2000);
+		     sum_food_vector(kcal2500, protein2500, *soln2500);
+		     TEST_LE("2000 kcal budget", kcal2000, 2000);
+		     TEST_LE("2500 kcal budget", kcal2500, 2500);
+		     TEST_EQUAL("2000 kcal solution", 501, protein2000);
+		     TEST_EQUAL("2500 kcal solution", 614, protein2500);
+		   });
+
+  rubric.criterion("ProteinCurve", 2,
+		   [&]() {
+		     FoodTable table(*filter_food_vector(*filtered_foods, 1, 2500, 200));
+		     ProteinCurve curve(table, 2500);
+		     TEST_EQUAL("max_kcal", 2500, curve.max_kcal());
+		     TEST_EQUAL("curve size", 2501, curve.curve().size());
+		     TEST_EQUAL("zero budget", 0, curve.protein_g(0));
+		     for (int budget = 0; budget <= 2500; budget += 100) {
+		       int kcal, protein;
+		       sum_food_table(kcal, protein, table, dp_max_protein(table, budget));
+		       TEST_EQUAL("same as dp", protein, curve.protein_g(budget));
+		       sum_food_table(kcal, protein, table, curve.foods(budget));
+		       TEST_EQUAL("reconstructed", curve.protein_g(budget), protein);
+		       TEST_LE("within budget", kcal, budget);
+		     }
+		     for (int budget = 1; budget <= 2500; budget++) {
+		       TEST_LE("non-decreasing", curve.protein_g(budget - 1), curve.protein_g(budget));
+		     }
+		   });
+
+  rubric.criterion("IncrementalProteinSolver", 2,
+		   [&]() {
+		     auto start = filter_food_vector(*filtered_foods, 1, 2000, 60);
+		     IncrementalProteinSolver solver(FoodTable(*start), 1500);
+		     TEST_EQUAL("size", 60, solver.size());
+
+		     // every food the solver has seen, by id
+		     FoodVector by_id(*start);
+		     auto check = [&](const char* message) {
+		       FoodVector present;
+		       for (size_t id = 0; id < by_id.size(); id++) {
+			 if (solver.contains(id)) {
+			   present.push_back(by_id[id]);
+			 }
+		       }
+		       TEST_EQUAL(message, present.size(), solver.size());
+		       int expected_kcal, expected_protein;
+		       sum_food_vector(expected_kcal, expected_protein, *dp_max_protein(present, 1500));
+		       TEST_EQUAL(message, expected_protein, solver.protein_g());
+		       int kcal = 0, protein = 0;
+		       for (size_t id : solver.foods()) {
+			 TEST_TRUE(message, solver.contains(id));
+			 kcal += by_id[id]->kcal();
+			 protein += by_id[id]->protein_g();
+		       }
+		       TEST_EQUAL(message, expected_protein, protein);
+		       TEST_LE(message, kcal, 1500);
+		     };
+		     check("initial");
+
+		     auto add = [&](size_t source) {
+		       auto& food = (*filtered_foods)[source];
+		       TEST_EQUAL("id", by_id.size(), solver.add_food(food->kcal(), food->protein_g()));
+		       by_id.push_back(food);
+		     };
+		     size_t best = solver.foods().front();
+		     solver.remove_food(best);
+		     check("remove one");
+		     add(1000);
+		     check("add one");
+		     solver.remove_food(59);
+		     solver.remove_food(0);
+		     check("remove both ends");
+		     for (size_t i = 2000; i < 2040; i++) {
+		       add(i);
+		     }
+		     check("add many");
+		     for (size_t id = 3; id < by_id.size(); id += 7) {
+		       if (solver.contains(id)) {
+			 solver.remove_food(id);
+		       }
+		     }
+		     check("remove many");
+		     solver.rebuild();
+		     check("rebuild");
+
+		     // each added food costs one layer, and answering again
+		     // costs none
+		     uint64_t layers = solver.layers();
+		     for (size_t i = 3000; i < 3005; i++) {
+		       add(i);
+		       check("add one layer");
+		       TEST_EQUAL("add one layer", layers + 1, solver.layers());
+		       layers = solver.layers();
+		     }
+		     check("no layers");
+		     TEST_EQUAL("no layers", layers, solver.layers());
+
+		     // the first and last base foods of a fresh solver
+		     IncrementalProteinSolver ends(FoodTable(*start), 1500);
+		     ends.remove_food(0);
+		     ends.remove_food(59);
+		     FoodVector middle(start->begin() + 1, start->end() - 1);
+		     int expected_kcal, expected_protein;
+		     sum_food_vector(expected_kcal, expected_protein, *dp_max_protein(middle, 1500));
+		     TEST_EQUAL("first and last", 58, ends.size());
+		     TEST_EQUAL("first and last", expected_protein, ends.protein_g());
+		     int kcal, protein;
+		     FoodVector chosen;
+		     for (size_t id : ends.foods()) {
+		       TEST_TRUE("first and last", id != 0 && id != 59);
+		       chosen.push_back((*start)[id]);
+		     }
+		     sum_food_vector(kcal, protein, chosen);
+		     TEST_EQUAL("first and last", expected_protein, protein);
+		     TEST_LE("first and last", kcal, 1500);
+		   });
+
+  rubric.criterion("branch_and_bound_max_protein trivial cases", 2,
+		   [&]() {
+		     auto soln = branch_and_bound_max_protein(trivial_foods, 99);
+		     TEST_TRUE("non-null", soln);
+		     TEST_TRUE("empty solution", soln->empty());
+
+		     soln = branch_and_bound_max_protein(trivial_foods, 100);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("banana only", 1, soln->size());
+		     TEST_EQUAL("banana only", "banana", (*soln)[0]->description());
+
+		     soln = branch_and_bound_max_protein(trivial_foods, 150);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("hotdog only", 1, soln->size());
+		     TEST_EQUAL("hotdog only", "hotdog", (*soln)[0]->description());
+
+		     soln = branch_and_bound_max_protein(trivial_foods, 250);
+		     TEST_TRUE("non-null", soln);
+		     TEST_EQUAL("hotdog and banana", 2, soln->size());
+		   });
+
+  rubric.criterion("branch_and_bound_max_protein correctness", 4,
+		   [&]() {
+		     for (int n = 2; n <= 18; n++) {
+		       int expected_protein = optimal_protein_totals[n-2];
+		       auto small_foods = filter_food_vector(*filtered_foods, 1, 2000, n);
+		       auto solution = branch_and_bound_max_protein(*small_foods, 2000);
+		       TEST_TRUE("non-null", solution);
+		       int actual_kcal, actual_protein;
+		       sum_food_vector(actual_kcal, actual_protein, *solution);
+		       std::stringstream ss;
+		       ss << "branch and bound n=" << n
+			  << ", expected protein=" << expected_protein
+			  << " but algorithm found=" << actual_protein;
+		       TEST_EQUAL(ss.str(), expected_protein, actual_protein);
+		       TEST_LE("within budget", actual_kcal, 2000);
+		     }
+
+		     BranchAndBoundStats stats;
+		     auto soln2000 = branch_and_bound_max_protein(*filtered_foods, 2000, &stats);
+		     int kcal2000, protein2000;
+		     sum_food_vector(kcal2000, protein2000, *soln2000);
+		     TEST_LE("2000 kcal budget", kcal2000, 2000);
+		     TEST_EQUAL("2000 kcal solution", 501, protein2000);
+		     TEST_GT("nodes counted", stats.nodes, 0);
+		     TEST_GT("prunes counted", stats.pruned, 0);
+		     TEST_GT("improvements counted", stats.improvements, 0);
+		     TEST_LT("far fewer nodes than subsets", stats.nodes, 100000);
+		   });
+
+  rubric.criterion("SolveCache", 2,
+		   [&]() {
+		     FoodTable table(*filtered_foods);
+		     SolveCache cache(1 << 20);
+		     auto first = cache.solve(table, 2000, Solver::dp);
+		     TEST_TRUE("same answer", first == dp_max_protein(table, 2000));
+		     TEST_TRUE("hit", first == cache.solve(table, 2000, Solver::dp));
+		     cache.solve(table, 2000, Solver::heap_greedy);
+		     cache.solve(table, 2500, Solver::dp);
+		     auto stats = cache.stats();
+		     TEST_EQUAL("hits", 1, stats.hits);
+		     TEST_EQUAL("misses", 3, stats.misses);
+		     TEST_EQUAL("entries", 3, stats.entries);
+		     TEST_LE("bytes", stats.bytes, cache.capacity_bytes());
+
+		     // same kcal and protein, different foods
+		     FoodTable copy(*table.to_food_vector());
+		     TEST_TRUE("shared", first == cache.solve(copy, 2000, Solver::dp));
+		     TEST_EQUAL("shared", 2, cache.stats().hits);
+
+		     // a key that collides with the result for other foods
+		     IndexVector collided;
+		     const SolveCacheKey key{food_table_hash(table), 2000, Solver::dp};
+		     FoodTable trivial_table(trivial_foods);
+		     TEST_FALSE("collision", cache.lookup(key, collided, &trivial_table));
+		     TEST_EQUAL("collision", 1, cache.stats().collisions);
+		     TEST_TRUE("no collision", cache.lookup(key, collided, &table));
+		     TEST_TRUE("no collision", first == collided);
+
+		     // room for only about one result
+		     SolveCache small(300);
+		     for (int budget : {100, 150, 250, 100}) {
+		       small.solve(trivial_table, budget, Solver::gray_code);
+		     }
+		     TEST_EQUAL("small misses", 4, small.stats().misses);
+		     TEST_GT("small evictions", small.stats().evictions, 0);
+		     TEST_LE("small bytes", small.stats().bytes, 300);
+
+		     // concurrent use
+		     SolveCache shared(1 << 20);
+		     std::vector<std::thread> threads;
+		     std::vector<int> protein(4);
+		     for (int t = 0; t < 4; t++) {
+		       threads.push_back(std::thread([&, t]() {
+			 for (int i = 0; i < 48; i++) {
+			   int kcal;
+			   sum_food_table(kcal, protein[t], trivial_table,
+					  shared.solve(trivial_table, 100 + 50 * (i % 4), Solver::dp));
+			 }
+		       }));
+		     }
+		     for (auto& thread : threads) {
+		       thread.join();
+		     }
+		     TEST_EQUAL("concurrent", 192, shared.stats().hits + shared.stats().misses);
+		     TEST_EQUAL("concurrent", 4, shared.stats().entries);
+		     for (int t = 0; t < 4; t++) {
+		       TEST_EQUAL("concurrent", 6, protein[t]);
+		     }
+		   });
+
+  rubric.criterion("prune_dominated_foods", 2,
+		   [&]() {
+		     FoodVector foods = trivial_foods;
+		     foods.push_back(std::shared_ptr<Food>(new Food("water", "1 cup", 237, 0, 0)));
+		     foods.push_back(std::shared_ptr<Food>(new Food("whale", "1 each", 1, 5000, 90)));
+		     for (int i = 0; i < 3; i++) {
+		       foods.push_back(std::shared_ptr<Food>(new Food("egg", "1 each", 50, 70, 6)));
+		     }
+		     foods.push_back(std::shared_ptr<Food>(new Food("toast", "1 slice", 30, 80, 2)));
+		     FoodTable table(foods);
+		     PruneReport report;
+		     // only two foods fit in 160 kcal, and two eggs beat the rest
+		     IndexVector kept = prune_dominated_foods(table, 160, &report);
+		     TEST_TRUE("kept", kept == (IndexVector{4, 5}));
+		     TEST_EQUAL("input", 8, report.input);
+		     TEST_EQUAL("zero_protein", 1, report.zero_protein);
+		     TEST_EQUAL("over_budget", 1, report.over_budget);
+		     TEST_EQUAL("duplicate", 1, report.duplicate);
+		     TEST_EQUAL("dominated", 3, report.dominated);
+		     TEST_EQUAL("kept", 2, report.kept);
+		     TEST_EQUAL("max_count", 2, report.max_count);
+
+		     for (int total_kcal : {-1, 0, 300, 1000, 2000}) {
+		       FoodTable all(*filtered_foods);
+		       IndexVector pruned = pruned_max_protein(all, total_kcal, Solver::dp, &report);
+		       int kcal, protein, expected;
+		       sum_food_table(kcal, expected, all, dp_max_protein(all, total_kcal));
+		       sum_food_table(kcal, protein, all, pruned);
+		       TEST_EQUAL("same protein", expected, protein);
+		       TEST_LE("within budget", kcal, std::max(total_kcal, 0));
+		       TEST_EQUAL("counts add up", report.input,
+				  report.zero_protein + report.over_budget + report.duplicate +
+				  report.dominated + report.kept);
+		     }
+		     TEST_LT("shrinks", report.kept, report.input / 4);
+
+		     // small enough for the exhaustive solvers
+		     FoodTable first(*filter_food_vector(*filtered_foods, 1, 2500, 200));
+		     int kcal, protein, expected;
+		     sum_food_table(kcal, expected, first, dp_max_protein(first, 100));
+		     sum_food_table(kcal, protein, first,
+				    pruned_max_protein(first, 100, Solver::gray_code, &report));
+		     TEST_EQUAL("gray code", expected, protein);
+		   });
+
+  rubric.criterion("SolverContext does not allocate", 2,
+		   [&]() {
+		     FoodTable table(*filter_food_vector(*filtered_foods, 1, 2500, 20));
+		     FoodTable large(*filtered_foods);
+		     SolverContext context;
+		     IndexVector result;
+		     int kcal, protein;
+		     for (Solver solver : {Solver::heap_greedy, Solver::gray_code,
+			   Solver::meet_in_middle, Solver::dp, Solver::branch_and_bound}) {
+		       // the first pass grows the buffers as needed
+		       for (int pass = 0; pass < 2; pass++) {
+			 const uint64_t before = allocation_count;
+			 for (int total_kcal : {2000, 500, -1, 0, 1500}) {
+			   solve_max_protein(result, table, total_kcal, solver, context);
+			   sum_food_table(kcal, protein, table,
+					  solve_max_protein(table, total_kcal, solver));
+			   int context_kcal, context_protein;
+			   sum_food_table(context_kcal, context_protein, table, result);
+			   TEST_EQUAL(solver_name(solver), protein, context_protein);
+			 }
+			 const uint64_t after_fresh = allocation_count;
+			 for (int total_kcal : {2000, 500, -1, 0, 1500}) {
+			   solve_max_protein(result, table, total_kcal, solver, context);
+			 }
+			 if (pass == 1) {
+			   TEST_EQUAL(solver_name(solver), after_fresh, allocation_count);
+			 }
+			 TEST_GT("fresh solves allocate", after_fresh, before);
+		       }
+		     }
+		     for (Solver solver : {Solver::heap_greedy, Solver::dp, Solver::branch_and_bound}) {
+		       solve_max_protein(result, large, 2000, solver, context);
+		       const uint64_t before = allocation_count;
+		       solve_max_protein(result, large, 2000, solver, context);
+		       TEST_EQUAL(solver_name(solver), before, allocation_count);
+		     }
+		   });
+
+  rubric.criterion("anytime_max_protein", 2,
+		   [&]() {
+		     FoodTable table(*all_foods);
+		     CancellationToken cancelled;
+		     cancelled.cancel();
+		     for (int total_kcal : {0, 500, 2000}) {
+		       int kcal, optimum;
+		       sum_food_table(kcal, optimum, table, dp_max_protein(table, total_kcal));
+		       AnytimeResult done = anytime_max_protein(table, total_kcal, 10.0);
+		       TEST_TRUE("complete", done.complete);
+		       TEST_TRUE("optimal", done.optimal());
+		       TEST_EQUAL("protein", optimum, done.protein_g);
+		       TEST_EQUAL("gap", 0.0, done.gap());
+
+		       // stopped at once, it still has the greedy answer and a bound
+		       for (AnytimeResult early : {anytime_max_protein(table, total_kcal, 0.0),
+			     anytime_max_protein(table, total_kcal, 10.0, &cancelled)}) {
+			 TEST_LE("kcal", early.kcal, total_kcal);
+			 TEST_LE("protein", early.protein_g, optimum);
+			 TEST_GE("upper bound", early.upper_bound, optimum);
+			 TEST_GE("greedy", early.protein_g, (optimum * 9) / 10);
+			 sum_food_table(kcal, early.protein_g, table, early.foods);
+			 TEST_EQUAL("kcal", kcal, early.kcal);
+		       }
+		     }
+		     TEST_TRUE("negative", anytime_max_protein(table, -1, 1.0).foods.empty());
+
+		     // equal density and an odd budget defeat the bound, so the
+		     // search runs out of time
+		     FoodVector even;
+		     for (int i = 0; i < 60; i++) {
+		       even.push_back(std::make_shared<Food>("even", "1", 1, 200 + 2 * i, 200 + 2 * i));
+		     }
+		     FoodTable hard(even);
+		     AnytimeResult partial = anytime_max_protein(hard, 3001, 0.005);
+		     TEST_FALSE("not complete", partial.complete);
+		     TEST_GT("nodes", partial.nodes, 0);
+		     TEST_EQUAL("protein", 3000, partial.protein_g);
+		     TEST_EQUAL("upper bound", 3001, partial.upper_bound);
+		     TEST_GT("gap", partial.gap(), 0.0);
+		     TEST_LT("gap", partial.gap(), 0.001);
+		   });
+
+  rubric.criterion("instrumentation", 2,
+		   [&]() {
+		     TEST_TRUE("enabled", INSTRUMENT_ENABLED);
+		     instrument_reset();
+		     auto foods = load_usda_abbrev("ABBREV.txt");
+		     TEST_EQUAL("load calls", 1, instrument_phase(Phase::load).calls);
+		     TEST_GT("load time", instrument_phase(Phase::load).seconds, 0.0);
+		     TEST_EQUAL("foods_loaded", 8490, instrument_counter(Counter::foods_loaded));
+		     TEST_GT("bytes_read", instrument_counter(Counter::bytes_read), 1000000);
+
+		     auto twenty = filter_food_vector(*foods, 1, 2500, 20);
+		     TEST_EQUAL("filter calls", 1, instrument_phase(Phase::filter).calls);
+		     TEST_EQUAL("foods_filtered", 20, instrument_counter(Counter::foods_filtered));
+
+		     FoodTable table(*twenty);
+		     gray_code_max_protein(table, 2000);
+		     TEST_EQUAL("subsets", 1 << 20, instrument_counter(Counter::subsets_evaluated));
+		     dp_max_protein(table, 2000);
+		     TEST_EQUAL("dp_cells", 20 * 2001, instrument_counter(Counter::dp_cells));
+		     TEST_GT("bytes_allocated", instrument_counter(Counter::bytes_allocated), 2001 * 4);
+		     BranchAndBoundStats stats;
+		     branch_and_bound_max_protein(table, 2000, &stats);
+		     TEST_EQUAL("search_nodes", stats.nodes, instrument_counter(Counter::search_nodes));
+		     TEST_EQUAL("search_pruned", stats.pruned, instrument_counter(Counter::search_pruned));
+		     for (Phase phase : {Phase::gray_code, Phase::dp, Phase::branch_and_bound}) {
+		       TEST_EQUAL(phase_name(phase), 1, instrument_phase(phase).calls);
+		     }
+		     TEST_EQUAL("not run", 0, instrument_phase(Phase::anytime).calls);
+
+		     std::ostringstream dump;
+		     instrument_dump(dump);
+		     TEST_TRUE("dump", dump.str().find("branch_and_bound") != std::string::npos);
+		     TEST_TRUE("dump", dump.str().find("dp_cells") != std::string::npos);
+		     TEST_TRUE("dump", dump.str().find("anytime") == std::string::npos);
+		     instrument_reset();
+		     TEST_EQUAL("reset", 0, instrument_counter(Counter::dp_cells));
+		   });
+
+  rubric.criterion("batch_max_protein", 2,
+		   [&]() {
+		     FoodTable table(*all_foods);
+		     std::vector<BatchQuery> queries;
+		     for (int total_kcal : {2000, -1, 0, 800, 2500}) {
+		       queries.push_back(BatchQuery{1, 2500, 200, total_kcal, Solver::dp});
+		       queries.push_back(BatchQuery{100, 600, 18, total_kcal, Solver::gray_code});
+		       queries.push_back(BatchQuery{1, 2500, 200, total_kcal, Solver::branch_and_bound});
+		       queries.push_back(BatchQuery{50, 300, 1000, total_kcal, Solver::heap_greedy});
+		     }
+		     ThreadPool pool(3);
+		     auto results = batch_max_protein(table, queries, pool);
+		     TEST_EQUAL("size", queries.size(), results.size());
+		     for (size_t q = 0; q < queries.size(); q++) {
+		       const BatchQuery& query = queries[q];
+		       auto filtered = filter_food_vector(*all_foods, query.min_kcal,
+							  query.max_kcal, query.total_size);
+		       FoodTable alone(*filtered);
+		       int kcal, protein;
+		       sum_food_table(kcal, protein, alone,
+				      solve_max_protein(alone, query.total_kcal, query.solver));
+		       TEST_EQUAL("protein", protein, results[q].protein_g);
+		       TEST_LE("kcal", results[q].kcal, std::max(query.total_kcal, 0));
+		       for (size_t i : results[q].foods) {
+			 TEST_TRUE("positions in source", i < table.size());
+		       }
+		     }
+		     TEST_TRUE("empty", batch_max_protein(table, {}, pool).empty());
+		   });
+
+  rubric.criterion("nutrient limits", 4,
+		   [&]() {
+		     auto nutrients = load_usda_abbrev_nutrients("ABBREV.txt");
+		     TEST_TRUE("loaded", !!nutrients);
+		     TEST_EQUAL("size", all_foods->size(), nutrients->size());
+		     TEST_EQUAL("butter kcal", 717, nutrients->amount(Nutrient::kcal, 0));
+		     TEST_EQUAL("butter fat", 81, nutrients->amount(Nutrient::fat_g, 0));
+		     TEST_EQUAL("butter carb", 0, nutrients->amount(Nutrient::carb_g, 0));
+		     TEST_EQUAL("butter sodium", 643, nutrients->amount(Nutrient::sodium_mg, 0));
+		     auto protein_of = [](const NutrientTable& table, const IndexVector& plan) {
+		       int total = 0;
+		       for (size_t i : plan) {
+			 total += table.protein_g(i);
+		       }
+		       return total;
+		     };
+
+		     // kcal alone is the knapsack dp_max_protein solves
+		     FoodTable table(nutrients->foods());
+		     int kcal, protein;
+		     sum_food_table(kcal, protein, table, dp_max_protein(table, 2000));
+		     NutrientLimits kcal_only(2000);
+		     IndexVector plan = multi_branch_and_bound_max_protein(*nutrients, kcal_only);
+		     TEST_EQUAL("kcal only", protein, protein_of(*nutrients, plan));
+
+		     NutrientLimits daily(2000, 65, 300, 2400);
+		     plan = nutrient_max_protein(*nutrients, daily);
+		     TEST_TRUE("within limits", within_limits(*nutrients, daily, plan));
+		     TEST_TRUE("sorted", std::is_sorted(plan.begin(), plan.end()));
+		     for (size_t i : plan) {
+		       TEST_TRUE("known sodium",
+				 nutrients->amount(Nutrient::sodium_mg, i) != NUTRIENT_UNKNOWN);
+		     }
+		     TEST_TRUE("negative limit",
+			       nutrient_max_protein(*nutrients, NutrientLimits(100, -1)).empty());
+		     // a 3000 x 200 x 300 table of ints alone is over 700 MB
+		     TEST_TRUE("dp bytes", multi_dp_bytes(NutrientLimits(3000, 200, 300), 1) > (uint64_t(1) << 24));
+
+		     // dp, branch and bound, and brute force agree on small tables
+		     for (size_t start = 0; start < 150; start += 10) {
+		       IndexVector positions;
+		       for (size_t i = start; i < start + 10; i++) {
+			 positions.push_back(i);
+		       }
+		       NutrientTable small = nutrients->subset(positions);
+		       NutrientLimits limits(100 + int(start), 2 + int(start % 7),
+					     (start % 30 == 0) ? 8 : NUTRIENT_NO_LIMIT, 100 + int(start));
+		       int best = 0;
+		       for (uint64_t mask = 0; mask < 1024; mask++) {
+			 IndexVector subset;
+			 indices_in_mask(subset, mask);
+			 if (within_limits(small, limits, subset)) {
+			   best = std::max(best, protein_of(small, subset));
+			 }
+		       }
+		       IndexVector dp = multi_dp_max_protein(small, limits),
+			 bb = multi_branch_and_bound_max_protein(small, limits);
+		       TEST_TRUE("dp within limits", within_limits(small, limits, dp));
+		       TEST_TRUE("bb within limits", within_limits(small, limits, bb));
+		       TEST_EQUAL("dp optimal", best, protein_of(small, dp));
+		       TEST_EQUAL("bb optimal", best, protein_of(small, bb));
+		     }
+		   });
+
+  rubric.criterion("fptas_max_protein", 2,
+		   [&]() {
+		     FoodTable table(*all_foods);
+		     for (int total_kcal : {-1, 0, 500, 2000}) {
+		       int kcal, protein, optimum;
+		       sum_food_table(kcal, optimum, table, dp_max_protein(table, std::max(total_kcal, 0)));
+		       sum_food_table(kcal, protein, table, fptas_max_protein(table, total_kcal, 0.1));
+		       // the database's protein is small enough to be solved unscaled
+		       TEST_EQUAL("exact", (total_kcal < 0) ? 0 : optimum, protein);
+		       TEST_LE("kcal", kcal, std::max(total_kcal, 0));
+		     }
+
+		     // protein large enough to be scaled
+		     FoodVector heavy;
+		     for (int i = 0; i < 12; i++) {
+		       heavy.push_back(std::shared_ptr<Food>(new Food("food", "1 each", 100,
+								     50 + 37 * i % 200,
+								     1000 + 7919 * i % 5000)));
+		     }
+		     auto optimum = exhaustive_max_protein(heavy, 600);
+		     int optimum_kcal, optimum_protein;
+		     sum_food_vector(optimum_kcal, optimum_protein, *optimum);
+		     for (double epsilon : {0.9, 0.5, 0.1, 0.01}) {
+		       auto found = fptas_max_protein(heavy, 600, epsilon);
+		       int kcal, protein;
+		       sum_food_vector(kcal, protein, *found);
+		       TEST_LE("kcal", kcal, 600);
+		       TEST_LE("near optimal", (1 - epsilon) * optimum_protein, double(protein));
+		       TEST_LE("not above optimal", protein, optimum_protein);
+		     }
+		   });
+
+  rubric.criterion("servings_max_protein", 2,
+		   [&]() {
+		     auto foods = filter_food_vector(*all_foods, 1, 400, 40);
+		     FoodTable table(*foods);
+		     int kcal, protein, expected_kcal, expected_protein;
+		     sum_food_table(expected_kcal, expected_protein, table, dp_max_protein(table, 1500));
+		     sum_food_table(kcal, protein, table, servings_max_protein(table, 1, 1500));
+		     TEST_EQUAL("one serving", expected_protein, protein);
+
+		     // the same as listing each food once per serving
+		     std::vector<int> servings(table.size());
+		     IndexVector copies;
+		     for (size_t i = 0; i < table.size(); i++) {
+		       servings[i] = (i % 4 == 0) ? SERVINGS_UNLIMITED : int(i % 4);
+		       const int count = std::min(servings[i], 1500 / table.kcal(i));
+		       copies.insert(copies.end(), count, i);
+		     }
+		     FoodTable copied = table.subset(copies);
+		     sum_food_table(expected_kcal, expected_protein, copied, dp_max_protein(copied, 1500));
+		     IndexVector plan = servings_max_protein(table, servings, 1500);
+		     sum_food_table(kcal, protein, table, plan);
+		     TEST_EQUAL("servings", expected_protein, protein);
+		     TEST_LE("kcal", kcal, 1500);
+		     TEST_TRUE("sorted", std::is_sorted(plan.begin(), plan.end()));
+		     for (size_t i : plan) {
+		       TEST_LE("limit", int(std::count(plan.begin(), plan.end(), i)), servings[i]);
+		     }
+		     TEST_EQUAL("food vector", plan.size(), table.to_food_vector(plan)->size());
+		     TEST_TRUE("negative budget", servings_max_protein(table, servings, -1).empty());
+		     TEST_TRUE("no servings", servings_max_protein(table, 0, 1500).empty());
+
+		     // a free food may have a limit near INT_MAX
+		     FoodVector free_food;
+		     free_food.push_back(std::shared_ptr<Food>(new Food("broth", "1 cup", 240, 0, 1)));
+		     ServingPieces pieces;
+		     split_servings(pieces, FoodTable(free_food), std::vector<int>(1, INT_MAX - 1), 1500);
+		     int64_t total_servings = 0;
+		     for (int count : pieces.servings) {
+		       total_servings += count;
+		     }
+		     TEST_EQUAL("pieces", size_t(31), pieces.servings.size());
+		     TEST_EQUAL("servings", int64_t(INT_MAX - 1), total_servings);
+		   });
+
+  rubric.criterion("accelerated solvers", 2,
+		   [&]() {
+		     TEST_TRUE("host", accelerator_available(Accelerator::host));
+		     TEST_FALSE("no cuda", accelerator_available(Accelerator::cuda));
+		     TEST_TRUE("best", best_accelerator() == Accelerator::host);
+		     for (Accelerator accelerator : {Accelerator::host, Accelerator::cuda}) {
+		       for (int n : {0, 1, 10, 20}) {
+			 FoodTable small(*filter_food_vector(*filtered_foods, 1, 2000, n));
+			 for (int total_kcal : {-1, 0, 2000}) {
+			   TEST_EQUAL(accelerator_name(accelerator),
+				      gray_code_max_protein(small, total_kcal),
+				      accelerated_exhaustive_max_protein(small, total_kcal, accelerator));
+			 }
+		       }
+		       FoodTable catalog(*filtered_foods);
+		       for (int total_kcal : {-1, 0, 2000}) {
+			 TEST_EQUAL(accelerator_name(accelerator),
+				    dp_max_protein(catalog, total_kcal),
+				    accelerated_dp_max_protein(catalog, total_kcal, accelerator));
+		       }
+		     }
+		   });
+
+  rubric.criterion("ThreadPool priorities and bound", 2,
+		   [&]() {
+		     ThreadPool pool(1, 3);
+		     TEST_EQUAL("capacity", 3, pool.capacity());
+		     // hold the only worker until every task is queued
+		     std::promise<void> release;
+		     std::shared_future<void> released(release.get_future());
+		     std::promise<void> started;
+		     auto hold = pool.submit([&]() { started.set_value(); released.wait(); });
+		     started.get_future().wait();
+
+		     std::mutex order_mutex;
+		     std::vector<int> order;
+		     auto record = [&](int i) {
+		       return [&, i]() {
+			 std::lock_guard<std::mutex> lock(order_mutex);
+			 order.push_back(i);
+		       };
+		     };
+		     std::future<void> low, normal, high, rejected;
+		     TEST_TRUE("low", pool.try_submit(low, record(2), TaskPriority::low));
+		     TEST_TRUE("normal", pool.try_submit(normal, record(1)));
+		     TEST_TRUE("high", pool.try_submit(high, record(0), TaskPriority::high));
+		     TEST_EQUAL("queued", 3, pool.queued());
+		     TEST_FALSE("full", pool.try_submit(rejected, record(3), TaskPriority::high));
+		     TEST_FALSE("left alone", rejected.valid());
+		     release.set_value();
+		     hold.get();
+		     low.get();
+		     normal.get();
+		     high.get();
+		     TEST_EQUAL("by priority", (std::vector<int>{0, 1, 2}), order);
+		     TEST_EQUAL("empty", 0, pool.queued());
+		   });
+
+  rubric.criterion("solve_async", 2,
+		   [&]() {
+		     FoodTable table(*filter_food_vector(*filtered_foods, 1, 2000, 20));
+		     std::vector<std::future<AsyncResult>> answers;
+		     const Solver solvers[] = {Solver::heap_greedy, Solver::gray_code,
+					       Solver::parallel_gray_code, Solver::meet_in_middle,
+					       Solver::dp, Solver::branch_and_bound};
+		     for (Solver solver : solvers) {
+		       answers.push_back(solve_async(table, 2000, solver));
+		     }
+		     for (size_t i = 0; i < answers.size(); i++) {
+		       AsyncResult result = answers[i].get();
+		       TEST_FALSE("finished", result.cancelled);
+		       TEST_EQUAL("same foods", solve_max_protein(table, 2000, solvers[i]), result.foods);
+		       int kcal, protein;
+		       sum_food_table(kcal, protein, table, result.foods);
+		       TEST_EQUAL("kcal", kcal, result.kcal);
+		       TEST_EQUAL("protein", protein, result.protein_g);
+		     }
+
+		     // cancelled before it starts
+		     auto cancel = std::make_shared<CancellationToken>();
+		     cancel->cancel();
+		     AsyncResult result = solve_async(table, 2000, Solver::dp, cancel).get();
+		     TEST_TRUE("cancelled", result.cancelled);
+		     TEST_TRUE("no foods", result.foods.empty());
+
+		     // cancelled while searching 2^40 subsets, which would take hours
+		     FoodTable forty(*filter_food_vector(*filtered_foods, 1, 2000, 40));
+		     ThreadPool pool(1, 1);
+		     for (Solver solver : {Solver::gray_code, Solver::branch_and_bound}) {
+		       cancel = std::make_shared<CancellationToken>();
+		       std::future<AsyncResult> answer;
+		       TEST_TRUE("submitted", try_solve_async(answer, pool, forty, 2000, solver, cancel));
+		       if (solver == Solver::gray_code) {
+			 TEST_TRUE("still running",
+				   answer.wait_for(std::chrono::milliseconds(20)) == std::future_status::timeout);
+		       }
+		       cancel->cancel();
+		       TEST_TRUE("stops", answer.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+		       result = answer.get();
+		       TEST_LE("within budget", result.kcal, 2000);
+		     }
+		   });
+
+  rubric.criterion("distributed search", 2,
+		   [&]() {
+		     FoodTable table(*filter_food_vector(*filtered_foods, 1, 2000, 18));
+		     auto protein_of = [&](const IndexVector& plan) {
+		       int kcal, protein;
+		       sum_food_table(kcal, protein, table, plan);
+		       return protein;
+		     };
+		     const int bnb_protein = protein_of(branch_and_bound_max_protein(table, 2000));
+		     for (DistributedKind kind : {DistributedKind::exhaustive, DistributedKind::branch_and_bound}) {
+		       DistributedSearch search(table, 2000, kind, (kind == DistributedKind::exhaustive) ? 8 : 4);
+		       // a worker that loses every third unit it is given
+		       uint64_t unit;
+		       for (int taken = 1; search.next_unit(unit); taken++) {
+			 if (taken % 3 == 0) {
+			   search.abandon(unit);
+			 } else {
+			   search.complete(run_distributed_unit(search.job(), unit, search.incumbent_protein()));
+			 }
+		       }
+		       TEST_TRUE("finished", search.finished());
+		       TEST_EQUAL("protein", bnb_protein, search.incumbent_protein());
+		       TEST_EQUAL("protein of foods", bnb_protein, protein_of(search.foods()));
+		       if (kind == DistributedKind::exhaustive) {
+			 TEST_EQUAL("same foods", gray_code_max_protein(table, 2000), search.foods());
+		       }
+		     }
+
+		     // results that do not hold up are not taken
+		     DistributedSearch checked(table, 2000, DistributedKind::exhaustive, 8);
+		     DistributedUnitResult bogus = run_distributed_unit(checked.job(), 0, -1);
+		     TEST_TRUE("valid", checked.valid_result(bogus));
+		     bogus.protein_g += 1;
+		     TEST_FALSE("wrong protein", checked.valid_result(bogus));
+		     bogus.protein_g -= 1;
+		     bogus.foods.push_back(64);
+		     TEST_FALSE("past the foods", checked.valid_result(bogus));
+		     bogus.foods.pop_back();
+		     bogus.unit = 1;
+		     TEST_FALSE("other unit", checked.valid_result(bogus));
+		     TEST_FALSE("not taken", checked.complete(bogus));
+		     TEST_EQUAL("none done", uint64_t(0), checked.units_done());
+		     DistributedJob job;
+		     std::istringstream huge("0 2000 4 1000000000000 1 2");
+		     TEST_FALSE("huge job", parse_distributed_job(job, huge));
+
+		     // the coordinator stops after a few units and is resumed
+		     const std::string path = "distributed_test.checkpoint";
+		     DistributedSearch first(table, 2000, DistributedKind::branch_and_bound, 4);
+		     uint64_t unit;
+		     for (int i = 0; i < 5 && first.next_unit(unit); i++) {
+		       first.complete(run_distributed_unit(first.job(), unit, first.incumbent_protein()));
+		     }
+		     TEST_TRUE("saved", first.save_checkpoint(path));
+		     DistributedSearch second(table, 2000, DistributedKind::branch_and_bound, 4);
+		     SnapshotStatus status;
+		     TEST_TRUE("resumed", second.resume(path, &status));
+		     TEST_EQUAL("units done", first.units_done(), second.units_done());
+		     TEST_EQUAL("incumbent", first.incumbent_protein(), second.incumbent_protein());
+		     DistributedSearch other(table, 1999, DistributedKind::branch_and_bound, 4);
+		     TEST_FALSE("other job", other.resume(path, &status));
+		     TEST_TRUE("stale", status == SnapshotStatus::stale);
+
+		     // on worker processes, one of which dies after two units
+		     const std::vector<std::string> workers = {
+		       "./maxprotein_distributed worker",
+		       "./maxprotein_distributed worker | head -n 2"
+		     };
+		     size_t failures;
+		     TEST_TRUE("workers finish", run_distributed_search(second, workers, path, 0, &failures));
+		     TEST_EQUAL("checkpoints saved", 0, failures);
+		     TEST_EQUAL("protein from workers", bnb_protein, protein_of(second.foods()));
+		     DistributedSearch resumed(table, 2000, DistributedKind::branch_and_bound, 4);
+		     TEST_TRUE("final checkpoint", resumed.resume(path) && resumed.finished());
+		     std::remove(path.c_str());
+
+		     FoodTable larger(*filter_food_vector(*filtered_foods, 1, 2000, 22));
+		     DistributedSearch exhaustive(larger, 2000, DistributedKind::exhaustive, 12);
+		     TEST_TRUE("exhaustive workers finish",
+			       run_distributed_search(exhaustive, workers, "no such directory/job.checkpoint",
+						      DISTRIBUTED_CHECKPOINT_SECONDS, &failures));
+		     TEST_EQUAL("checkpoint failed", 1, failures);
+		     TEST_EQUAL("same foods from workers", gray_code_max_protein(larger, 2000), exhaustive.foods());
+		   });
+
   return rubric.run();
 }
@@ -0,0 +1,788 @@
+///////////////////////////////////////////////////////////////////////////////
+// nutrients.hh
+//
+// Maximize protein subject to limits on more than kcal: fat,
+// carbohydrate and sodium too.
+//
+// The nutrient columns are loaded beside a FoodTable into a
+// NutrientTable. Small limits are solved exactly with a dynamic
+// programming table with one axis per limited nutrient. Anything
+// bigger, up to the whole database, is solved exactly with branch and
+// bound, bounded by a surrogate knapsack whose nutrient weights are
+// Lagrange multipliers found by subgradient descent.
+//
+// How to use:
+//
+//    auto table = load_usda_abbrev_nutrients("ABBREV.txt");
+//    NutrientLimits limits(2000, 65, 300, 2400);  // kcal, g, g, mg
+//    IndexVector plan = nutrient_max_protein(*table, limits);
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "maxprotein.hh"
+
+// The nutrients a plan can be limited in.
+enum class Nutrient {
+  kcal,
+  fat_g,
+  carb_g,
+  sodium_mg,
+  count
+};
+
+const int NUTRIENT_COUNT = int(Nutrient::count);
+
+const char* nutrient_name(Nutrient nutrient) {
+  static const char* const names[] = {"kcal", "fat_g", "carb_g", "sodium_mg"};
+  return names[int(nutrient)];
+}
+
+// The most of each nutrient a plan may hold. NUTRIENT_NO_LIMIT, the
+// default, leaves a nutrient unlimited.
+const int NUTRIENT_NO_LIMIT = INT_MAX;
+
+class NutrientLimits {
+public:
+  NutrientLimits(int kcal = NUTRIENT_NO_LIMIT,
+		 int fat_g = NUTRIENT_NO_LIMIT,
+		 int carb_g = NUTRIENT_NO_LIMIT,
+		 int sodium_mg = NUTRIENT_NO_LIMIT)
+    : _limit{kcal, fat_g, carb_g, sodium_mg} { }
+
+  int operator[](Nutrient nutrient) const { return _limit[int(nutrient)]; }
+  void set(Nutrient nutrient, int limit) { _limit[int(nutrient)] = limit; }
+
+  bool limited(Nutrient nutrient) const {
+    return _limit[int(nutrient)] != NUTRIENT_NO_LIMIT;
+  }
+
+private:
+  int _limit[NUTRIENT_COUNT];
+};
+
+// A FoodTable together with the fat, carbohydrate and sodium of each
+// food. A value is NUTRIENT_UNKNOWN when the ABBREV file leaves it
+// empty; such a food is never chosen while that nutrient is limited.
+class NutrientTable {
+public:
+  // Give every food of foods the given columns, each of foods.size()
+  // values.
+  NutrientTable(const FoodTable& foods,
+		std::vector<int32_t> fat_g,
+		std::vector<int32_t> carb_g,
+		std::vector<int32_t> sodium_mg)
+    : _foods(foods) {
+    assert(fat_g.size() == foods.size());
+    assert(carb_g.size() == foods.size());
+    assert(sodium_mg.size() == foods.size());
+    _columns[0] = std::move(fat_g);
+    _columns[1] = std::move(carb_g);
+    _columns[2] = std::move(sodium_mg);
+  }
+
+  const FoodTable& foods() const { return _foods; }
+  size_t size() const { return _foods.size(); }
+
+  int protein_g(size_t i) const { return _foods.protein_g(i); }
+
+  // Amount of nutrient in food i.
+  int amount(Nutrient nutrient, size_t i) const {
+    assert(i < size());
+    return column(nutrient)[i];
+  }
+
+  // The amounts of nutrient in every food, in order.
+  const int32_t* column(Nutrient nutrient) const {
+    if (nutrient == Nutrient::kcal) {
+      return _foods.kcal_column();
+    }
+    return _columns[int(nutrient) - 1].data();
+  }
+
+  // Return a new table of the foods at the given positions, in the
+  // given order, as FoodTable::subset does.
+  NutrientTable subset(const IndexVector& indices) const {
+    std::vector<int32_t> picked[NUTRIENT_COUNT - 1];
+    for (int n = 0; n < NUTRIENT_COUNT - 1; n++) {
+      for (size_t i : indices) {
+	picked[n].push_back(_columns[n][i]);
+      }
+    }
+    return NutrientTable(_foods.subset(indices),
+			 std::move(picked[0]),
+			 std::move(picked[1]),
+			 std::move(picked[2]));
+  }
+
+private:
+  FoodTable _foods;
+  // fat_g, carb_g and sodium_mg
+  std::vector<int32_t> _columns[NUTRIENT_COUNT - 1];
+};
+
+// Load all the valid foods of the ABBREV file at path with their
+// nutrients, mapping the file as load_usda_abbrev_mapped does. Returns
+// nullptr on I/O error.
+std::unique_ptr<NutrientTable> load_usda_abbrev_nutrients(const std::string& path) {
+  std::vector<int32_t> fat_g, carb_g, sodium_mg;
+  auto foods = load_usda_abbrev_mapped(path, [&](const AbbrevRecord& record) {
+    fat_g.push_back(record.fat_g);
+    carb_g.push_back(record.carb_g);
+    sodium_mg.push_back(record.sodium_mg);
+  });
+  if (!foods) {
+    return std::unique_ptr<NutrientTable>(nullptr);
+  }
+  return std::unique_ptr<NutrientTable>(new NutrientTable(*foods,
+							  std::move(fat_g),
+							  std::move(carb_g),
+							  std::move(sodium_mg)));
+}
+
+// Total amount of nutrient in the foods at the given positions; unknown
+// amounts count as zero.
+int nutrient_total(const NutrientTable& table,
+		   Nutrient nutrient,
+		   const IndexVector& indices) {
+  int total = 0;
+  for (size_t i : indices) {
+    total += std::max(table.amount(nutrient, i), 0);
+  }
+  return total;
+}
+
+// Whether the foods at the given positions are within every limit,
+// with no unknown amount of a limited nutrient.
+bool within_limits(const NutrientTable& table,
+		   const NutrientLimits& limits,
+		   const IndexVector& indices) {
+  for (int n = 0; n < NUTRIENT_COUNT; n++) {
+    const Nutrient nutrient = Nutrient(n);
+    if (!limits.limited(nutrient)) {
+      continue;
+    }
+    int64_t total = 0;
+    for (size_t i : indices) {
+      if (table.amount(nutrient, i) == NUTRIENT_UNKNOWN) {
+	return false;
+      }
+      total += table.amount(nutrient, i);
+    }
+    if (total > limits[nutrient]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The foods of a table that could be part of a plan within limits,
+// with one weight per limited nutrient: those with protein, known
+// amounts of every limited nutrient, and no amount over its limit.
+struct NutrientKnapsack {
+  // limits of the limited nutrients
+  std::vector<int> caps;
+  // for each food kept, its position in the table, protein, and
+  // weights[d] the amount of the d-th limited nutrient
+  IndexVector positions;
+  std::vector<int> protein;
+  std::vector<std::vector<int>> weights;
+  // false if some limit is negative, so only the empty plan fits
+  bool feasible = true;
+};
+
+NutrientKnapsack prepare_nutrient_knapsack(const NutrientTable& table,
+					   const NutrientLimits& limits) {
+	NutrientKnapsack problem;
+	std::vector<const int32_t*> columns;
+	for (int n = 0; n < NUTRIENT_COUNT; n++)
+	{
+		if (limits.limited(Nutrient(n)))
+		{
+			problem.caps.push_back(limits[Nutrient(n)]);
+			columns.push_back(table.column(Nutrient(n)));
+			if (limits[Nutrient(n)] < 0)
+				problem.feasible = false;
+		}
+	}
+	const size_t dims = problem.caps.size();
+	problem.weights.resize(dims);
+	if (!problem.feasible)
+		return problem;
+	for (size_t i = 0; i < table.size(); i++)
+	{
+		bool keep = table.protein_g(i) > 0;
+		for (size_t d = 0; keep && d < dims; d++)
+			keep = columns[d][i] != NUTRIENT_UNKNOWN && columns[d][i] <= problem.caps[d];
+		if (!keep)
+			continue;
+		problem.positions.push_back(i);
+		problem.protein.push_back(table.protein_g(i));
+		for (size_t d = 0; d < dims; d++)
+			problem.weights[d].push_back(columns[d][i]);
+	}
+	return problem;
+}
+
+// Number of cells in each layer of multi_dp_max_protein's table: the
+// product of one more than each limit. Saturates at UINT64_MAX.
+uint64_t multi_dp_cells(const NutrientLimits& limits) {
+	uint64_t cells = 1;
+	for (int n = 0; n < NUTRIENT_COUNT; n++)
+	{
+		if (!limits.limited(Nutrient(n)))
+			continue;
+		const uint64_t width = uint64_t(std::max(limits[Nutrient(n)], 0)) + 1;
+		if (cells > UINT64_MAX / width)
+			return UINT64_MAX;
+		cells *= width;
+	}
+	return cells;
+}
+
+// Bytes of memory multi_dp_max_protein's table takes for n foods: an
+// int of best protein and one take bit per food for each of the
+// multi_dp_cells(limits) cells. Saturates at UINT64_MAX.
+uint64_t multi_dp_bytes(const NutrientLimits& limits, size_t n) {
+	const uint64_t cells = multi_dp_cells(limits);
+	const uint64_t per_cell_bits = 8 * sizeof(int) + n;
+	if (cells > UINT64_MAX / per_cell_bits)
+		return UINT64_MAX;
+	return (cells * per_cell_bits + 7) / 8;
+}
+
+// Compute the optimal plan within limits exactly with 0/1 knapsack
+// dynamic programming over every combination of amounts of the limited
+// nutrients, the multi-dimensional version of dp_max_protein. The
+// table has multi_dp_cells(limits) cells, indexed in mixed radix, and
+// one bit per food per cell records what was taken, so this takes
+// O(n cells) time and bits of space and only suits small limits.
+// Returns the positions of the chosen foods in increasing order.
+IndexVector multi_dp_max_protein(const NutrientTable& table,
+				 const NutrientLimits& limits) {
+	IndexVector result;
+	const NutrientKnapsack problem = prepare_nutrient_knapsack(table, limits);
+	if (!problem.feasible)
+		return result;
+	const size_t dims = problem.caps.size(), m = problem.positions.size();
+	std::vector<size_t> stride(dims + 1, 1);
+	for (size_t d = 0; d < dims; d++)
+		stride[d + 1] = stride[d] * (size_t(problem.caps[d]) + 1);
+	const size_t cells = stride[dims];
+	INSTRUMENT_SCOPE(Phase::dp);
+	INSTRUMENT_COUNT(Counter::dp_cells, m * cells);
+
+	std::vector<int> best(cells, 0);
+	std::vector<uint64_t> taken((m * cells + 63) / 64, 0);
+	std::vector<int> coord(dims);
+	for (size_t j = 0; j < m; j++)
+	{
+		size_t offset = 0;
+		for (size_t d = 0; d < dims; d++)
+			offset += problem.weights[d][j] * stride[d];
+		// visit every cell from the last to the first, so the cell each
+		// one reads still has its value from before food j
+		for (size_t d = 0; d < dims; d++)
+			coord[d] = problem.caps[d];
+		for (size_t cell = cells; cell-- > 0; )
+		{
+			bool fits = true;
+			for (size_t d = 0; fits && d < dims; d++)
+				fits = coord[d] >= problem.weights[d][j];
+			if (fits)
+			{
+				const int with = best[cell - offset] + problem.protein[j];
+				if (with > best[cell])
+				{
+					best[cell] = with;
+					const size_t bit = j * cells + cell;
+					taken[bit / 64] |= uint64_t(1) << (bit % 64);
+				}
+			}
+			// step coord back to the previous cell
+			for (size_t d = 0; d < dims; d++)
+			{
+				if (coord[d] > 0)
+				{
+					coord[d]--;
+					break;
+				}
+				coord[d] = problem.caps[d];
+			}
+		}
+	}
+
+	size_t cell = cells - 1;
+	for (size_t j = m; j-- > 0; )
+	{
+		const size_t bit = j * cells + cell;
+		if ((taken[bit / 64] >> (bit % 64)) & 1)
+		{
+			result.push_back(problem.positions[j]);
+			for (size_t d = 0; d < dims; d++)
+				cell -= problem.weights[d][j] * stride[d];
+		}
+	}
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+// Counters describing the work done by one call to
+// multi_branch_and_bound_max_protein.
+struct NutrientSearchStats {
+  uint64_t nodes = 0;
+  uint64_t pruned = 0;
+  uint64_t improvements = 0;
+  // The Lagrangian bound at the root, and the protein of the plan the
+  // search started from.
+  double root_bound = 0;
+  int seed_protein = 0;
+};
+
+// Find Lagrange multipliers for the limits of problem, one per limited
+// nutrient, by projected subgradient descent on the Lagrangian dual of
+// its linear relaxation. With each nutrient scaled by its limit, the
+// dual is
+//
+//    L(lambda) = sum_d lambda_d + sum_j max(0, p_j - sum_d lambda_d w_dj)
+//
+// over lambda >= 0, and every L(lambda) bounds the optimum. Steps use
+// the Polyak rule toward lower_bound, the protein of a known plan.
+// Returns the multipliers of the least L found, divided by each limit
+// so they weigh unscaled amounts, and stores that L in bound.
+std::vector<double> nutrient_multipliers(const NutrientKnapsack& problem,
+					 int lower_bound,
+					 double& bound) {
+	const size_t dims = problem.caps.size(), m = problem.positions.size();
+	// scaled weights; a zero limit only keeps foods with none of it
+	std::vector<std::vector<double>> scaled(dims, std::vector<double>(m, 0.0));
+	for (size_t d = 0; d < dims; d++)
+	{
+		for (size_t j = 0; problem.caps[d] > 0 && j < m; j++)
+			scaled[d][j] = double(problem.weights[d][j]) / problem.caps[d];
+	}
+
+	std::vector<double> lambda(dims, 0.0), best_lambda(dims, 0.0), gradient(dims);
+	bound = HUGE_VAL;
+	double theta = 2.0;
+	int stalled = 0;
+	for (int iteration = 0; iteration < 300 && theta > 1e-4; iteration++)
+	{
+		double value = 0;
+		for (size_t d = 0; d < dims; d++)
+		{
+			value += lambda[d];
+			gradient[d] = 1.0;
+		}
+		for (size_t j = 0; j < m; j++)
+		{
+			double reduced = problem.protein[j];
+			for (size_t d = 0; d < dims; d++)
+				reduced -= lambda[d] * scaled[d][j];
+			if (reduced > 0)
+			{
+				value += reduced;
+				for (size_t d = 0; d < dims; d++)
+					gradient[d] -= scaled[d][j];
+			}
+		}
+		if (value < bound)
+		{
+			bound = value;
+			best_lambda = lambda;
+			stalled = 0;
+		}
+		else if (++stalled == 15)
+		{
+			theta /= 2;
+			stalled = 0;
+		}
+
+		// a direction that is zero after projection means lambda is optimal
+		double norm = 0;
+		for (size_t d = 0; d < dims; d++)
+		{
+			if (lambda[d] > 0 || gradient[d] < 0)
+				norm += gradient[d] * gradient[d];
+		}
+		if (norm < 1e-12 || value - lower_bound < 1e-9)
+			break;
+		const double step = theta * (value - lower_bound) / norm;
+		for (size_t d = 0; d < dims; d++)
+			lambda[d] = std::max(0.0, lambda[d] - step * gradient[d]);
+	}
+
+	for (size_t d = 0; d < dims; d++)
+		best_lambda[d] = (problem.caps[d] > 0) ? best_lambda[d] / problem.caps[d] : 0.0;
+	return best_lambda;
+}
+
+// Store in surrogate the surrogate weight of each food of problem, its
+// weights summed with multipliers, and in order the foods in
+// decreasing protein/surrogate order, zero surrogate weight first.
+void surrogate_order(std::vector<size_t>& order,
+		     std::vector<double>& surrogate,
+		     const NutrientKnapsack& problem,
+		     const std::vector<double>& multipliers) {
+	const size_t m = problem.positions.size();
+	surrogate.assign(m, 0.0);
+	for (size_t j = 0; j < m; j++)
+	{
+		for (size_t d = 0; d < problem.caps.size(); d++)
+			surrogate[j] += multipliers[d] * problem.weights[d][j];
+	}
+	order.clear();
+	for (size_t j = 0; j < m; j++)
+		order.push_back(j);
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		const double lhs = problem.protein[a] * surrogate[b],
+			rhs = problem.protein[b] * surrogate[a];
+		return (lhs > rhs) || (lhs == rhs && a < b);
+	});
+}
+
+// Depth-first search state for multi_branch_and_bound_max_protein.
+// Each food has a surrogate weight, the multiplier-weighted sum of its
+// nutrients, and the foods are held in decreasing protein/surrogate
+// weight order, with prefix sums so that the fractional knapsack bound
+// of any suffix within the remaining surrogate capacity is found by
+// binary search, as in BranchAndBoundSearch. Including a food also
+// checks every real limit.
+class NutrientSearch {
+public:
+  NutrientSearch(const NutrientKnapsack& problem,
+		 const std::vector<double>& multipliers,
+		 NutrientSearchStats& stats)
+    : _problem(problem),
+      _dims(problem.caps.size()),
+      _remaining(problem.caps),
+      _best_protein(0),
+      _stats(stats) {
+    const size_t m = problem.positions.size();
+    std::vector<double> surrogate;
+    surrogate_order(_order, surrogate, problem, multipliers);
+    _capacity = 0;
+    for (size_t d = 0; d < _dims; d++) {
+      _capacity += multipliers[d] * problem.caps[d];
+    }
+    _surrogate.resize(m);
+    _prefix_surrogate.assign(m + 1, 0.0);
+    _prefix_protein.assign(m + 1, 0);
+    for (size_t i = 0; i < m; i++) {
+      _surrogate[i] = surrogate[_order[i]];
+      _prefix_surrogate[i + 1] = _prefix_surrogate[i] + _surrogate[i];
+      _prefix_protein[i + 1] = _prefix_protein[i] + problem.protein[_order[i]];
+    }
+    _chosen.assign(m, false);
+    _best_chosen.assign(m, false);
+  }
+
+  // The foods of the problem in search order.
+  const std::vector<size_t>& order() const { return _order; }
+
+  // Fractional surrogate bound of the whole problem.
+  double root_bound() const { return bound(0, _capacity); }
+
+  // Set the protein of a plan to beat, which need not be made of the
+  // problem's foods.
+  void seed(int protein) { _best_protein = protein; }
+
+  // Search every plan, or until node_limit nodes have been visited,
+  // returning the best one found as flags in search order. Unless
+  // best_protein() is more than the seed, none was found and the flags
+  // are all false.
+  const std::vector<bool>& run(uint64_t node_limit = UINT64_MAX) {
+    _nodes_left = node_limit;
+    visit(0, _capacity, 0);
+    return _best_chosen;
+  }
+
+  // Whether the last run stopped at its node limit.
+  bool stopped() const { return _nodes_left == 0; }
+
+  int best_protein() const { return _best_protein; }
+
+private:
+  // Whether food i in search order fits in what is left of every limit.
+  bool fits(size_t i) const {
+    const size_t j = _order[i];
+    for (size_t d = 0; d < _dims; d++) {
+      if (_problem.weights[d][j] > _remaining[d]) {
+	return false;
+      }
+    }
+    return true;
+  }
+
+  double bound(size_t i, double capacity) const {
+    auto it = std::upper_bound(_prefix_surrogate.begin() + i, _prefix_surrogate.end(),
+			       _prefix_surrogate[i] + capacity + 1e-9);
+    const size_t j = (it - _prefix_surrogate.begin()) - 1;
+    double value = double(_prefix_protein[j] - _prefix_protein[i]);
+    if (j < _surrogate.size()) {
+      const double left = capacity - (_prefix_surrogate[j] - _prefix_surrogate[i]);
+      value += std::max(left, 0.0) * _problem.protein[_order[j]] / _surrogate[j];
+    }
+    return value;
+  }
+
+  void visit(size_t i, double capacity, int protein) {
+    if (_nodes_left == 0) {
+      return;
+    }
+    _nodes_left--;
+    _stats.nodes++;
+    if (protein > _best_protein) {
+      _best_protein = protein;
+      _best_chosen = _chosen;
+      _stats.improvements++;
+    }
+    if (i == _order.size()) {
+      return;
+    }
+    if (protein + std::floor(bound(i, capacity) + 1e-6) <= _best_protein) {
+      _stats.pruned++;
+      return;
+    }
+    const size_t j = _order[i];
+    if (fits(i)) {
+      for (size_t d = 0; d < _dims; d++) {
+	_remaining[d] -= _problem.weights[d][j];
+      }
+      _chosen[i] = true;
+      visit(i + 1, capacity - _surrogate[i], protein + _problem.protein[j]);
+      _chosen[i] = false;
+      for (size_t d = 0; d < _dims; d++) {
+	_remaining[d] += _problem.weights[d][j];
+      }
+    }
+    visit(i + 1, capacity, protein);
+  }
+
+  const NutrientKnapsack& _problem;
+  const size_t _dims;
+  std::vector<int> _remaining;
+  std::vector<size_t> _order;
+  std::vector<double> _surrogate, _prefix_surrogate;
+  std::vector<int64_t> _prefix_protein;
+  double _capacity;
+  std::vector<bool> _chosen, _best_chosen;
+  int _best_protein;
+  uint64_t _nodes_left;
+  NutrientSearchStats& _stats;
+};
+
+// Add to chosen, which holds flags for the foods of problem, each food
+// in the given order that fits in remaining, and take it from
+// remaining.
+void nutrient_greedy(std::vector<bool>& chosen,
+		     std::vector<int>& remaining,
+		     const NutrientKnapsack& problem,
+		     const std::vector<size_t>& order) {
+	const size_t dims = problem.caps.size();
+	for (size_t j : order)
+	{
+		bool fits = !chosen[j];
+		for (size_t d = 0; fits && d < dims; d++)
+			fits = problem.weights[d][j] <= remaining[d];
+		if (fits)
+		{
+			chosen[j] = true;
+			for (size_t d = 0; d < dims; d++)
+				remaining[d] -= problem.weights[d][j];
+		}
+	}
+}
+
+// The problem made of the foods of problem listed in foods, in that
+// order.
+NutrientKnapsack nutrient_knapsack_subset(const NutrientKnapsack& problem,
+					  const std::vector<size_t>& foods) {
+	const size_t dims = problem.caps.size();
+	NutrientKnapsack subset;
+	subset.caps = problem.caps;
+	subset.weights.resize(dims);
+	subset.feasible = problem.feasible;
+	for (size_t j : foods)
+	{
+		subset.positions.push_back(problem.positions[j]);
+		subset.protein.push_back(problem.protein[j]);
+		for (size_t d = 0; d < dims; d++)
+			subset.weights[d].push_back(problem.weights[d][j]);
+	}
+	return subset;
+}
+
+// Search state of multi_branch_and_bound_max_protein for one problem:
+// its foods by decreasing reduced protein p_j - sum_d multipliers_d
+// w_dj, the Lagrangian bound of those multipliers, and the best plan
+// so far.
+//
+// A plan that includes food j has at most bound + p_j - sum_d
+// multipliers_d w_dj protein, so once a plan with lower_bound protein
+// is known, only the foods whose reduced protein is more than
+// lower_bound + 1 - bound may be part of a better one. Those are a
+// prefix of the order, and with a close bound, a short one.
+struct NutrientCore {
+  std::vector<size_t> order;
+  std::vector<double> reduced_protein;
+  double bound = 0;
+  int lower_bound = 0;
+  IndexVector best;
+
+  // Number of foods in order that may be part of a better plan.
+  size_t candidates() const {
+    size_t k = 0;
+    while (k < order.size() &&
+	   (reduced_protein[order[k]] >= 0 ||
+	    std::floor(bound + reduced_protein[order[k]] + 1e-6) > lower_bound)) {
+      k++;
+    }
+    return k;
+  }
+};
+
+// Search the first k foods of core's order for a plan better than
+// core.lower_bound, visiting at most node_limit nodes, and keep it in
+// core. Returns whether the search finished.
+bool search_nutrient_core(NutrientCore& core,
+			  const NutrientKnapsack& problem,
+			  const std::vector<double>& multipliers,
+			  size_t k,
+			  uint64_t node_limit,
+			  NutrientSearchStats& stats) {
+	const std::vector<size_t> foods(core.order.begin(), core.order.begin() + k);
+	const NutrientKnapsack subset = nutrient_knapsack_subset(problem, foods);
+	NutrientSearch search(subset, multipliers, stats);
+	search.seed(core.lower_bound);
+	const std::vector<bool>& best = search.run(node_limit);
+	if (search.best_protein() > core.lower_bound)
+	{
+		core.lower_bound = search.best_protein();
+		core.best.clear();
+		for (size_t i = 0; i < best.size(); i++)
+		{
+			if (best[i])
+				core.best.push_back(subset.positions[search.order()[i]]);
+		}
+	}
+	return !search.stopped();
+}
+
+// Compute the optimal plan within limits exactly with branch and
+// bound. A greedy plan by protein per share of the limits gives a
+// lower bound, subgradient descent then finds Lagrange multipliers for
+// the limits, and a second greedy pass in the resulting surrogate
+// order may improve the plan. The search, as in
+// branch_and_bound_max_protein, prunes every subtree whose fractional
+// surrogate knapsack bound cannot beat the best plan so far.
+//
+// Searching every food at once is slow when the limits are tight, so
+// the search first runs on a small core of the foods with the most
+// reduced protein (see NutrientCore), and the core doubles until it
+// holds every food that could be part of a better plan than the best
+// found. Better plans shrink that set, and usually only a few hundred
+// of thousands of foods remain. If stats is non-null, it receives the
+// work done. Returns the positions of the chosen foods in increasing
+// order.
+IndexVector multi_branch_and_bound_max_protein(const NutrientTable& table,
+					       const NutrientLimits& limits,
+					       NutrientSearchStats* stats = nullptr) {
+	INSTRUMENT_SCOPE(Phase::branch_and_bound);
+	NutrientSearchStats local_stats;
+	if (stats == nullptr)
+		stats = &local_stats;
+	*stats = NutrientSearchStats();
+	const NutrientKnapsack problem = prepare_nutrient_knapsack(table, limits);
+	if (!problem.feasible)
+		return IndexVector();
+	const size_t dims = problem.caps.size(), m = problem.positions.size();
+
+	// greedy by protein per total share of the limits, to start from
+	std::vector<double> share(dims);
+	for (size_t d = 0; d < dims; d++)
+		share[d] = (problem.caps[d] > 0) ? 1.0 / problem.caps[d] : 0.0;
+	std::vector<bool> chosen(m, false);
+	std::vector<int> remaining(problem.caps);
+	std::vector<size_t> order;
+	std::vector<double> surrogate;
+	surrogate_order(order, surrogate, problem, share);
+	nutrient_greedy(chosen, remaining, problem, order);
+	NutrientCore core;
+	for (size_t j = 0; j < m; j++)
+	{
+		if (chosen[j])
+			core.lower_bound += problem.protein[j];
+	}
+
+	const std::vector<double> multipliers = nutrient_multipliers(problem, core.lower_bound, core.bound);
+	// fill what is left of the limits in the new order
+	surrogate_order(order, surrogate, problem, multipliers);
+	nutrient_greedy(chosen, remaining, problem, order);
+	core.lower_bound = 0;
+	for (size_t j = 0; j < m; j++)
+	{
+		if (chosen[j])
+		{
+			core.lower_bound += problem.protein[j];
+			core.best.push_back(problem.positions[j]);
+		}
+	}
+	stats->seed_protein = core.lower_bound;
+	stats->root_bound = core.bound;
+
+	core.reduced_protein.resize(m);
+	for (size_t j = 0; j < m; j++)
+	{
+		core.reduced_protein[j] = problem.protein[j];
+		for (size_t d = 0; d < dims; d++)
+			core.reduced_protein[j] -= multipliers[d] * problem.weights[d][j];
+		core.order.push_back(j);
+	}
+	std::sort(core.order.begin(), core.order.end(), [&](size_t a, size_t b) {
+		return core.reduced_protein[a] > core.reduced_protein[b] ||
+		       (core.reduced_protein[a] == core.reduced_protein[b] && a < b);
+	});
+
+	// a core search may stop at its node limit, so only a finished
+	// search of every candidate proves the plan optimal
+	const uint64_t core_node_limit = uint64_t(1) << 22;
+	size_t k = std::min<size_t>(32, m);
+	for (;;)
+	{
+		const bool finished = search_nutrient_core(core, problem, multipliers, k,
+							   core_node_limit, *stats);
+		const size_t candidates = core.candidates();
+		if (candidates <= k || k == m)
+		{
+			if (!finished)
+				search_nutrient_core(core, problem, multipliers, candidates, UINT64_MAX, *stats);
+			break;
+		}
+		k = std::min(2 * k, m);
+	}
+	std::sort(core.best.begin(), core.best.end());
+	INSTRUMENT_COUNT(Counter::search_nodes, stats->nodes);
+	INSTRUMENT_COUNT(Counter::search_pruned, stats->pruned);
+	return core.best;
+}
+
+// Compute the optimal plan within limits exactly, with
+// multi_dp_max_protein when its best protein and take bits would take
+// at most dp_bytes bytes together, and with
+// multi_branch_and_bound_max_protein otherwise.
+IndexVector nutrient_max_protein(const NutrientTable& table,
+				 const NutrientLimits& limits,
+				 uint64_t dp_bytes = uint64_t(1) << 24) {
+	if (multi_dp_bytes(limits, table.size()) <= dp_bytes)
+		return multi_dp_max_protein(table, limits);
+	return multi_branch_and_bound_max_protein(table, limits);
+}
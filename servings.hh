@@ -0,0 +1,142 @@
+///////////////////////////////////////////////////////////////////////////////
+// servings.hh
+//
+// Maximize protein when a food may be eaten more than once: each food
+// has a greatest number of servings, or no limit at all.
+//
+// Listing a food once per serving would double the exhaustive solvers'
+// work for every extra serving and multiply the dp table's memory.
+// Instead each food's servings are split into binary pieces of 1, 2,
+// 4, ... servings plus a remainder, so any count up to the limit is a
+// sum of distinct pieces, and the pieces are solved as a 0/1 knapsack.
+// A food with up to c servings becomes about log2(c) pieces, and an
+// unlimited food is limited to the servings that fit in the budget.
+//
+// How to use:
+//
+//    std::vector<int> servings(table.size(), 3);  // up to 3 of each
+//    servings[0] = SERVINGS_UNLIMITED;
+//    IndexVector plan = servings_max_protein(table, servings, 2000);
+//    // plan lists food i once per serving, e.g. {0, 0, 4, 7, 7, 7}
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+#include "maxprotein.hh"
+
+// Serving limit of a food that may be eaten any number of times.
+const int SERVINGS_UNLIMITED = INT_MAX;
+
+// The binary pieces of every food's servings, for a budget of
+// total_kcal. Piece k stands for servings[k] servings of food[k].
+struct ServingPieces {
+  IndexVector food;
+  std::vector<int> servings;
+  std::vector<int> kcal;
+  std::vector<int> protein_g;
+};
+
+// Split the servings of every food of foods into pieces. Servings that
+// could never fit in total_kcal are dropped, and so are foods with no
+// protein.
+void split_servings(ServingPieces& pieces,
+		    const FoodTable& foods,
+		    const std::vector<int>& max_servings,
+		    int total_kcal) {
+	assert(max_servings.size() == foods.size());
+	assert(total_kcal >= 0);
+	pieces.food.clear();
+	pieces.servings.clear();
+	pieces.kcal.clear();
+	pieces.protein_g.clear();
+	for (size_t i = 0; i < foods.size(); i++)
+	{
+		const int kcal = foods.kcal(i), protein = foods.protein_g(i);
+		// a free food with protein and no limit has no best plan
+		assert(kcal > 0 || max_servings[i] != SERVINGS_UNLIMITED || protein == 0);
+		int left = max_servings[i];
+		if (kcal > 0)
+			left = std::min(left, total_kcal / kcal);
+		if (protein == 0)
+			left = 0;
+		// 64-bit, so doubling past 2^30 for a limit near INT_MAX does
+		// not overflow
+		for (int64_t piece = 1; left > 0; piece *= 2)
+		{
+			const int count = int(std::min<int64_t>(piece, left));
+			assert(int64_t(count) * protein <= INT_MAX);
+			pieces.food.push_back(i);
+			pieces.servings.push_back(count);
+			pieces.kcal.push_back(count * kcal);
+			pieces.protein_g.push_back(count * protein);
+			left -= count;
+		}
+	}
+}
+
+// Compute the plan with the most protein within total_kcal exactly,
+// taking at most max_servings[i] servings of food i, which may be
+// SERVINGS_UNLIMITED unless the food has 0 kcal and some protein. The
+// dp is dp_max_protein's over the binary pieces of the servings, so it
+// takes O(P total_kcal) time and P total_kcal bits for P pieces.
+// Returns the positions of the chosen foods in increasing order, with
+// each position repeated once per serving, so sum_food_table and
+// FoodTable::to_food_vector count every serving.
+IndexVector servings_max_protein(const FoodTable& foods,
+				 const std::vector<int>& max_servings,
+				 int total_kcal) {
+	INSTRUMENT_SCOPE(Phase::dp);
+	IndexVector result;
+	if (total_kcal < 0)
+		return result;
+	ServingPieces pieces;
+	split_servings(pieces, foods, max_servings, total_kcal);
+
+	const size_t width = size_t(total_kcal) + 1, count = pieces.food.size();
+	std::vector<int> best(width, 0);
+	std::vector<uint64_t> taken((count * width + 63) / 64, 0);
+	INSTRUMENT_COUNT(Counter::dp_cells, count * width);
+	INSTRUMENT_COUNT(Counter::bytes_allocated,
+			 best.capacity() * sizeof(int) + taken.capacity() * sizeof(uint64_t));
+	for (size_t k = 0; k < count; k++)
+	{
+		const size_t row = k * width;
+		for (int c = total_kcal; c >= pieces.kcal[k]; c--)
+		{
+			const int with = best[c - pieces.kcal[k]] + pieces.protein_g[k];
+			if (with > best[c])
+			{
+				best[c] = with;
+				const size_t bit = row + c;
+				taken[bit / 64] |= uint64_t(1) << (bit % 64);
+			}
+		}
+	}
+
+	int c = total_kcal;
+	for (size_t k = count; k-- > 0; )
+	{
+		const size_t bit = k * width + c;
+		if ((taken[bit / 64] >> (bit % 64)) & 1)
+		{
+			result.insert(result.end(), pieces.servings[k], pieces.food[k]);
+			c -= pieces.kcal[k];
+		}
+	}
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+// Same as above, with the same serving limit for every food.
+IndexVector servings_max_protein(const FoodTable& foods,
+				 int max_servings,
+				 int total_kcal) {
+	return servings_max_protein(foods, std::vector<int>(foods.size(), max_servings), total_kcal);
+}
@@ -0,0 +1,213 @@
+///////////////////////////////////////////////////////////////////////////////
+// snapshot.hh
+//
+// Compact binary snapshots of a food database, which can be
+// memory-mapped and used as a FoodTable immediately, without parsing.
+//
+// A snapshot holds a fixed header followed by the kcal, protein_g and
+// amount_g columns (int32_t each), the text offsets (four uint32_t per
+// food, as in FoodTable), and finally a string pool with every
+// description and amount. Numbers are stored in native byte order; a
+// snapshot written on a machine of the other byte order fails the
+// header check. The header records the size and modification time of
+// the ABBREV file the snapshot was made from, so a snapshot that has
+// gone stale is noticed and the text file is loaded instead.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "mappedfile.hh"
+#include "maxprotein.hh"
+
+// Why a snapshot could or could not be used.
+enum class SnapshotStatus {
+  ok,
+  // The snapshot file or the ABBREV file could not be read.
+  missing,
+  // Wrong magic number, version or byte order, truncated, the
+  // checksum does not match, or a text offset is out of bounds.
+  corrupt,
+  // The ABBREV file has changed since the snapshot was written.
+  stale
+};
+
+// The first bytes of every snapshot file.
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  // Always 0x01020304 in the byte order of the writer.
+  uint32_t byte_order;
+  uint64_t food_count;
+  uint64_t pool_size;
+  // Size and modification time of the ABBREV file.
+  uint64_t source_size;
+  int64_t source_mtime;
+  // FNV-1a hash of every byte after the header.
+  uint64_t checksum;
+};
+
+const char SNAPSHOT_MAGIC[8] = {'M', 'A', 'X', 'P', 'R', 'O', 'T', '\0'};
+const uint32_t SNAPSHOT_VERSION = 1;
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+// Find the size and modification time of the file at path. Returns
+// false on I/O error.
+bool file_signature(uint64_t& size, int64_t& mtime, const std::string& path) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    return false;
+  }
+  size = info.st_size;
+  mtime = info.st_mtime;
+  return true;
+}
+
+// Write the foods of table to a snapshot file at path, recording the
+// size and modification time of source_path, the ABBREV file the
+// table was loaded from. Returns false on I/O error.
+bool write_food_snapshot(const FoodTable& table,
+			 const std::string& path,
+			 const std::string& source_path) {
+  SnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.byte_order = SNAPSHOT_BYTE_ORDER;
+  header.food_count = table.size();
+  if (!file_signature(header.source_size, header.source_mtime, source_path)) {
+    return false;
+  }
+
+  // pack the text, which may be scattered through a mapping
+  std::string pool;
+  std::vector<uint32_t> text;
+  text.reserve(4 * table.size());
+  for (size_t i = 0; i < table.size(); i++) {
+    for (StringRef s : {table.description(i), table.amount(i)}) {
+      text.push_back(pool.size());
+      pool.append(s.data(), s.size());
+      text.push_back(pool.size());
+    }
+  }
+  header.pool_size = pool.size();
+
+  const size_t column_bytes = table.size() * sizeof(int32_t);
+  uint64_t hash = fnv1a_hash(table.kcal_column(), column_bytes);
+  hash = fnv1a_hash(table.protein_g_column(), column_bytes, hash);
+  hash = fnv1a_hash(table.amount_g_column(), column_bytes, hash);
+  hash = fnv1a_hash(text.data(), text.size() * sizeof(uint32_t), hash);
+  hash = fnv1a_hash(pool.data(), pool.size(), hash);
+  header.checksum = hash;
+
+  std::ofstream f(path, std::ios::binary | std::ios::trunc);
+  if (!f) {
+    return false;
+  }
+  f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  f.write(reinterpret_cast<const char*>(table.kcal_column()), column_bytes);
+  f.write(reinterpret_cast<const char*>(table.protein_g_column()), column_bytes);
+  f.write(reinterpret_cast<const char*>(table.amount_g_column()), column_bytes);
+  f.write(reinterpret_cast<const char*>(text.data()), text.size() * sizeof(uint32_t));
+  f.write(pool.data(), pool.size());
+  f.close();
+  return bool(f);
+}
+
+// Map the snapshot at path as a FoodTable whose columns and text all
+// point into the mapping, so nothing is parsed or copied. If
+// source_path is non-empty, the snapshot must also have been written
+// from the current version of that ABBREV file. Returns nullptr if the
+// snapshot cannot be used, and if status is non-null, stores why.
+std::unique_ptr<FoodTable> load_food_snapshot(const std::string& path,
+					      const std::string& source_path,
+					      SnapshotStatus* status = nullptr) {
+  SnapshotStatus local_status;
+  if (status == nullptr) {
+    status = &local_status;
+  }
+  std::unique_ptr<FoodTable> failure(nullptr);
+
+  std::shared_ptr<MappedFile> file(new MappedFile);
+  if (!file->open(path)) {
+    *status = SnapshotStatus::missing;
+    return failure;
+  }
+
+  SnapshotHeader header;
+  *status = SnapshotStatus::corrupt;
+  if (file->size() < sizeof(header)) {
+    return failure;
+  }
+  std::memcpy(&header, file->data(), sizeof(header));
+  if ((std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) ||
+      (header.version != SNAPSHOT_VERSION) ||
+      (header.byte_order != SNAPSHOT_BYTE_ORDER)) {
+    return failure;
+  }
+  const uint64_t n = header.food_count;
+  const uint64_t body_size = 7 * n * sizeof(uint32_t) + header.pool_size;
+  if ((n > file->size()) || (header.pool_size > file->size()) ||
+      (file->size() - sizeof(header) != body_size)) {
+    return failure;
+  }
+  const char* body = file->data() + sizeof(header);
+  if (fnv1a_hash(body, body_size) != header.checksum) {
+    return failure;
+  }
+
+  // every string must lie within the pool, even in a snapshot whose
+  // checksum was recomputed after tampering
+  const int32_t* columns = reinterpret_cast<const int32_t*>(body);
+  const uint32_t* text = reinterpret_cast<const uint32_t*>(columns + 3 * n);
+  const char* pool = reinterpret_cast<const char*>(text + 4 * n);
+  for (uint64_t i = 0; i < 4 * n; i += 2) {
+    if ((text[i] > text[i + 1]) || (text[i + 1] > header.pool_size)) {
+      return failure;
+    }
+  }
+
+  if (!source_path.empty()) {
+    uint64_t source_size;
+    int64_t source_mtime;
+    if (!file_signature(source_size, source_mtime, source_path)) {
+      *status = SnapshotStatus::missing;
+      return failure;
+    }
+    if ((source_size != header.source_size) || (source_mtime != header.source_mtime)) {
+      *status = SnapshotStatus::stale;
+      return failure;
+    }
+  }
+
+  *status = SnapshotStatus::ok;
+  return std::unique_ptr<FoodTable>(new FoodTable(n,
+						  columns,
+						  columns + n,
+						  columns + 2 * n,
+						  text,
+						  pool,
+						  file));
+}
+
+// Load all the valid foods from the ABBREV file at source_path. If
+// the snapshot at snapshot_path is intact and up to date, it is mapped
+// with load_food_snapshot; otherwise the text file is loaded with
+// load_usda_abbrev_mapped. Returns nullptr on I/O error.
+std::unique_ptr<FoodTable> load_usda_abbrev_snapshot(const std::string& source_path,
+						     const std::string& snapshot_path) {
+  std::unique_ptr<FoodTable> table = load_food_snapshot(snapshot_path, source_path);
+  if (table) {
+    return table;
+  }
+  return load_usda_abbrev_mapped(source_path);
+}
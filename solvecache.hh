@@ -0,0 +1,217 @@
+///////////////////////////////////////////////////////////////////////////////
+// solvecache.hh
+//
+// A thread-safe LRU cache of solver results, so that a query that was
+// already answered for the same foods, budget and solver comes back
+// without solving it again.
+//
+// How to use:
+//
+//    SolveCache cache(16 << 20);  // at most about 16 MB of results
+//    IndexVector plan = cache.solve(foods, 2000, Solver::dp);
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "maxprotein.hh"
+
+// What a cached result is an answer to. foods_hash is
+// food_table_hash() of the foods, so two food sets with the same kcal
+// and protein columns share results. Two different food sets can hash
+// alike; results cached from a FoodTable keep its columns to tell them
+// apart.
+struct SolveCacheKey {
+  uint64_t foods_hash;
+  int total_kcal;
+  Solver solver;
+
+  bool operator==(const SolveCacheKey& other) const {
+    return (foods_hash == other.foods_hash) &&
+      (total_kcal == other.total_kcal) &&
+      (solver == other.solver);
+  }
+};
+
+// Hash function for SolveCacheKey, so it can key an unordered_map.
+struct SolveCacheKeyHash {
+  size_t operator()(const SolveCacheKey& key) const {
+    uint64_t hash = key.foods_hash;
+    hash = (hash ^ uint32_t(key.total_kcal)) * 1099511628211ULL;
+    hash = (hash ^ uint32_t(key.solver)) * 1099511628211ULL;
+    return hash;
+  }
+};
+
+// Counters describing how a SolveCache has been used.
+struct SolveCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  // Lookups whose key matched a result for different foods, also
+  // counted as misses.
+  uint64_t collisions = 0;
+  // Number of results, and estimated bytes they occupy.
+  size_t entries = 0;
+  size_t bytes = 0;
+};
+
+class SolveCache {
+public:
+  // Create an empty cache that holds at most about capacity_bytes of
+  // results, counting the positions and the bookkeeping of each entry.
+  explicit SolveCache(size_t capacity_bytes)
+    : _capacity_bytes(capacity_bytes),
+      _bytes(0) { }
+
+  SolveCache(const SolveCache&) = delete;
+  SolveCache& operator=(const SolveCache&) = delete;
+
+  // Look up the result for key. On a hit, copy it to result, mark it
+  // most recently used and return true. If foods is non-null and the
+  // result was inserted with its foods, the two must have the same kcal
+  // and protein columns, so a hash collision is a miss and not another
+  // table's answer.
+  bool lookup(const SolveCacheKey& key, IndexVector& result,
+	      const FoodTable* foods = nullptr) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _map.find(key);
+    if (it == _map.end()) {
+      _stats.misses++;
+      return false;
+    }
+    if ((foods != nullptr) && !it->second->columns.empty() &&
+	!same_columns(it->second->columns, *foods)) {
+      _stats.misses++;
+      _stats.collisions++;
+      return false;
+    }
+    _stats.hits++;
+    _lru.splice(_lru.begin(), _lru, it->second);
+    result = it->second->result;
+    return true;
+  }
+
+  // Store result as the answer for key, replacing any earlier one, and
+  // evict least recently used results until the cache fits its
+  // capacity. A result bigger than the whole capacity is not stored.
+  // If foods is non-null, its kcal and protein columns are kept with
+  // the result and checked by lookup.
+  void insert(const SolveCacheKey& key, const IndexVector& result,
+	      const FoodTable* foods = nullptr) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _map.find(key);
+    if (it != _map.end()) {
+      remove(it->second);
+    }
+    Entry entry{key, result, std::vector<int32_t>()};
+    if (foods != nullptr) {
+      entry.columns.assign(foods->kcal_column(), foods->kcal_column() + foods->size());
+      entry.columns.insert(entry.columns.end(), foods->protein_g_column(),
+			   foods->protein_g_column() + foods->size());
+    }
+    if (entry_bytes(entry) > _capacity_bytes) {
+      return;
+    }
+    _bytes += entry_bytes(entry);
+    _lru.push_front(std::move(entry));
+    _map[key] = _lru.begin();
+    while (_bytes > _capacity_bytes) {
+      remove(std::prev(_lru.end()));
+      _stats.evictions++;
+    }
+  }
+
+  // Return the result of solve_max_protein(foods, total_kcal, solver),
+  // from the cache if possible. The lock is not held while solving, so
+  // two threads that miss on the same key at once both solve it.
+  IndexVector solve(const FoodTable& foods, int total_kcal, Solver solver) {
+    const SolveCacheKey key{food_table_hash(foods), total_kcal, solver};
+    IndexVector result;
+    if (!lookup(key, result, &foods)) {
+      result = solve_max_protein(foods, total_kcal, solver);
+      insert(key, result, &foods);
+    }
+    return result;
+  }
+
+  // Return the cached result for key, or else compute it by calling
+  // compute() and cache it. Callers that run the same foods many times
+  // can compute food_table_hash once and build keys themselves. These
+  // results are keyed by the hash alone, so a collision returns the
+  // answer for the other foods; at 64 bits that is accepted.
+  IndexVector solve(const SolveCacheKey& key,
+		    const std::function<IndexVector()>& compute) {
+    IndexVector result;
+    if (!lookup(key, result)) {
+      result = compute();
+      insert(key, result);
+    }
+    return result;
+  }
+
+  // Remove every result, keeping the counters.
+  void clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _map.clear();
+    _lru.clear();
+    _bytes = 0;
+  }
+
+  size_t capacity_bytes() const { return _capacity_bytes; }
+
+  SolveCacheStats stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    SolveCacheStats stats = _stats;
+    stats.entries = _lru.size();
+    stats.bytes = _bytes;
+    return stats;
+  }
+
+private:
+  struct Entry {
+    SolveCacheKey key;
+    IndexVector result;
+    // kcal then protein_g of the foods, or empty if not known.
+    std::vector<int32_t> columns;
+  };
+  typedef std::list<Entry>::iterator EntryIterator;
+
+  // Estimated memory used by entry: its positions and columns, the
+  // list node and the hash table node.
+  static size_t entry_bytes(const Entry& entry) {
+    return sizeof(Entry) + 2 * sizeof(void*) +
+      entry.result.capacity() * sizeof(size_t) +
+      entry.columns.capacity() * sizeof(int32_t) +
+      sizeof(SolveCacheKey) + sizeof(EntryIterator) + 2 * sizeof(void*);
+  }
+
+  static bool same_columns(const std::vector<int32_t>& columns, const FoodTable& foods) {
+    const size_t n = foods.size();
+    return (columns.size() == 2 * n) &&
+      std::equal(foods.kcal_column(), foods.kcal_column() + n, columns.begin()) &&
+      std::equal(foods.protein_g_column(), foods.protein_g_column() + n, columns.begin() + n);
+  }
+
+  void remove(EntryIterator it) {
+    _bytes -= entry_bytes(*it);
+    _map.erase(it->key);
+    _lru.erase(it);
+  }
+
+  const size_t _capacity_bytes;
+  size_t _bytes;
+  // most recently used first
+  std::list<Entry> _lru;
+  std::unordered_map<SolveCacheKey, EntryIterator, SolveCacheKeyHash> _map;
+  SolveCacheStats _stats;
+  mutable std::mutex _mutex;
+};
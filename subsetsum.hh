@@ -0,0 +1,421 @@
+///////////////////////////////////////////////////////////////////////////////
+// subsetsum.hh
+//
+// Kernels that evaluate the kcal and protein totals of many subsets of
+// foods at once, working directly on int32_t kcal and protein columns
+// such as those of a FoodTable.
+//
+// Each kernel splits the foods into a few low foods, whose every
+// combination makes up one "block" of consecutive bitmasks, and the
+// remaining high foods, which are walked in Gray-code order with
+// scalar running totals. The AVX2 kernel evaluates a block of 8
+// bitmasks with one vector add, and the AVX-512 kernel a block of 16.
+// The scalar kernel has blocks of a single bitmask and works
+// everywhere. best_subset_sum_kernel() picks the widest kernel the
+// CPU supports at run time.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SUBSETSUM_X86 1
+#include <immintrin.h>
+#endif
+
+// Index of the lowest set bit in a nonzero mask. Used to find which
+// food flips between consecutive subsets in Gray-code order.
+int lowest_set_bit(uint64_t mask) {
+  assert(mask != 0);
+  return __builtin_ctzll(mask);
+}
+
+// The best subset found by a scan: greatest protein, and among equal
+// protein the numerically smallest bitmask. protein_g is -1 until
+// some subset fits.
+struct GrayCodeBest {
+  int protein_g = -1;
+  uint64_t mask = 0;
+
+  // Replace this with (protein_g, mask) if that subset is better.
+  void offer(int protein_g, uint64_t mask) {
+    if (protein_g > this->protein_g ||
+	(protein_g == this->protein_g && mask < this->mask)) {
+      this->protein_g = protein_g;
+      this->mask = mask;
+    }
+  }
+};
+
+// One subset of half of the foods, as enumerated by
+// meet_in_middle_max_protein. Bit j of mask stands for the j-th food
+// of that half.
+struct HalfSubset {
+  int kcal;
+  int protein_g;
+  uint32_t mask;
+};
+
+// The available subset-sum kernels.
+enum class SubsetSumKernel {
+  scalar,
+  avx2,
+  avx512
+};
+
+// Number of low foods whose combinations make up one block of the
+// given kernel; a block holds 2^subset_sum_low_bits(kernel) bitmasks.
+int subset_sum_low_bits(SubsetSumKernel kernel) {
+  switch (kernel) {
+  case SubsetSumKernel::avx2:
+    return 3;
+  case SubsetSumKernel::avx512:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+// Return true if this CPU can run the given kernel.
+bool subset_sum_kernel_supported(SubsetSumKernel kernel) {
+  switch (kernel) {
+  case SubsetSumKernel::scalar:
+    return true;
+#ifdef SUBSETSUM_X86
+  case SubsetSumKernel::avx2:
+    return __builtin_cpu_supports("avx2");
+  case SubsetSumKernel::avx512:
+    return __builtin_cpu_supports("avx512f");
+#endif
+  default:
+    return false;
+  }
+}
+
+// The widest kernel this CPU supports, detected once.
+SubsetSumKernel best_subset_sum_kernel() {
+  static const SubsetSumKernel best =
+    subset_sum_kernel_supported(SubsetSumKernel::avx512) ? SubsetSumKernel::avx512 :
+    subset_sum_kernel_supported(SubsetSumKernel::avx2) ? SubsetSumKernel::avx2 :
+    SubsetSumKernel::scalar;
+  return best;
+}
+
+// The kernel to use for n foods: preferred, unless there are too few
+// foods to fill one of its blocks, in which case scalar.
+SubsetSumKernel subset_sum_kernel_for(int n, SubsetSumKernel preferred) {
+  assert(subset_sum_kernel_supported(preferred));
+  return (n >= subset_sum_low_bits(preferred)) ? preferred : SubsetSumKernel::scalar;
+}
+
+// Running kcal and protein totals of the high foods, i.e. those from
+// index low_bits onwards, as their Gray-code rank advances.
+class HighSubsetWalk {
+public:
+  // Start at Gray-code rank first, summing its foods directly.
+  HighSubsetWalk(const int32_t* kcal,
+		 const int32_t* protein,
+		 int n,
+		 int low_bits,
+		 uint64_t first)
+    : _kcal(kcal + low_bits),
+      _protein(protein + low_bits),
+      _mask(first ^ (first >> 1)),
+      _sum_kcal(0),
+      _sum_protein(0) {
+    for (int j = 0; j < n - low_bits; j++) {
+      if ((_mask >> j) & 1) {
+	_sum_kcal += _kcal[j];
+	_sum_protein += _protein[j];
+      }
+    }
+  }
+
+  // Advance to Gray-code rank i, which must be one past the current
+  // rank; this flips exactly one food.
+  void step(uint64_t i) {
+    const int j = lowest_set_bit(i);
+    const uint64_t bit = uint64_t(1) << j;
+    _mask ^= bit;
+    if (_mask & bit) {
+      _sum_kcal += _kcal[j];
+      _sum_protein += _protein[j];
+    } else {
+      _sum_kcal -= _kcal[j];
+      _sum_protein -= _protein[j];
+    }
+  }
+
+  uint64_t mask() const { return _mask; }
+  int kcal() const { return _sum_kcal; }
+  int protein_g() const { return _sum_protein; }
+
+private:
+  const int32_t* _kcal;
+  const int32_t* _protein;
+  uint64_t _mask;
+  int _sum_kcal, _sum_protein;
+};
+
+// Compute the kcal and protein totals of each of the 2^low_bits
+// combinations of the low foods, indexed by combination bitmask.
+void low_subset_sums(int32_t* lane_kcal,
+		     int32_t* lane_protein,
+		     const int32_t* kcal,
+		     const int32_t* protein,
+		     int low_bits) {
+  lane_kcal[0] = lane_protein[0] = 0;
+  for (int j = 0; j < low_bits; j++) {
+    const int half = 1 << j;
+    for (int l = 0; l < half; l++) {
+      lane_kcal[half + l] = lane_kcal[l] + kcal[j];
+      lane_protein[half + l] = lane_protein[l] + protein[j];
+    }
+  }
+}
+
+// Scalar kernel: scan the subsets of the n foods with Gray-code ranks
+// first through last - 1, i.e. bitmasks i ^ (i >> 1), offering each
+// one that fits within total_kcal to best.
+void gray_code_scan(GrayCodeBest& best,
+		    const int32_t* kcal,
+		    const int32_t* protein,
+		    int n,
+		    uint64_t first,
+		    uint64_t last,
+		    int total_kcal) {
+  if (first >= last) {
+    return;
+  }
+  HighSubsetWalk walk(kcal, protein, n, 0, first);
+  if (walk.kcal() <= total_kcal) {
+    best.offer(walk.protein_g(), walk.mask());
+  }
+  for (uint64_t i = first + 1; i < last; i++) {
+    walk.step(i);
+    if (walk.kcal() <= total_kcal) {
+      best.offer(walk.protein_g(), walk.mask());
+    }
+  }
+}
+
+// Scalar kernel: append every subset of the count foods whose
+// calories fit within total_kcal to output.
+void gray_code_collect(std::vector<HalfSubset>& output,
+		       const int32_t* kcal,
+		       const int32_t* protein,
+		       int count,
+		       int total_kcal) {
+  assert(count < 32);
+  const uint64_t subsets = uint64_t(1) << count;
+  HighSubsetWalk walk(kcal, protein, count, 0, 0);
+  for (uint64_t i = 0; i < subsets; i++) {
+    if (i > 0) {
+      walk.step(i);
+    }
+    if (walk.kcal() <= total_kcal) {
+      output.push_back(HalfSubset{walk.kcal(), walk.protein_g(), uint32_t(walk.mask())});
+    }
+  }
+}
+
+#ifdef SUBSETSUM_X86
+
+// AVX2 kernel: as gray_code_scan, but first and last are Gray-code
+// ranks of the high foods, and each rank stands for a block of 8
+// bitmasks, one per combination of the 3 low foods.
+__attribute__((target("avx2")))
+void subset_sum_scan_avx2(GrayCodeBest& best,
+			  const int32_t* kcal,
+			  const int32_t* protein,
+			  int n,
+			  uint64_t first,
+			  uint64_t last,
+			  int total_kcal) {
+  const int low_bits = 3;
+  if (first >= last) {
+    return;
+  }
+  alignas(32) int32_t lane_kcal[8], lane_protein[8];
+  low_subset_sums(lane_kcal, lane_protein, kcal, protein, low_bits);
+  const __m256i low_kcal = _mm256_load_si256((const __m256i*) lane_kcal),
+    low_protein = _mm256_load_si256((const __m256i*) lane_protein),
+    budget = _mm256_set1_epi32(total_kcal);
+  HighSubsetWalk walk(kcal, protein, n, low_bits, first);
+  for (uint64_t i = first; i < last; i++) {
+    if (i > first) {
+      walk.step(i);
+    }
+    const __m256i block_kcal = _mm256_add_epi32(_mm256_set1_epi32(walk.kcal()), low_kcal),
+      block_protein = _mm256_add_epi32(_mm256_set1_epi32(walk.protein_g()), low_protein);
+    // lanes that fit and have at least the best protein so far
+    const __m256i candidates =
+      _mm256_andnot_si256(_mm256_cmpgt_epi32(block_kcal, budget),
+			  _mm256_cmpgt_epi32(block_protein,
+					     _mm256_set1_epi32(best.protein_g - 1)));
+    for (unsigned lanes = _mm256_movemask_ps(_mm256_castsi256_ps(candidates));
+	 lanes != 0;
+	 lanes &= lanes - 1) {
+      const int l = lowest_set_bit(lanes);
+      best.offer(walk.protein_g() + lane_protein[l], (walk.mask() << low_bits) | l);
+    }
+  }
+}
+
+// AVX2 kernel: as gray_code_collect, eight bitmasks at a time.
+__attribute__((target("avx2")))
+void subset_sum_collect_avx2(std::vector<HalfSubset>& output,
+			     const int32_t* kcal,
+			     const int32_t* protein,
+			     int count,
+			     int total_kcal) {
+  const int low_bits = 3;
+  assert(count < 32 && count >= low_bits);
+  alignas(32) int32_t lane_kcal[8], lane_protein[8];
+  low_subset_sums(lane_kcal, lane_protein, kcal, protein, low_bits);
+  const __m256i low_kcal = _mm256_load_si256((const __m256i*) lane_kcal),
+    budget = _mm256_set1_epi32(total_kcal);
+  const uint64_t blocks = uint64_t(1) << (count - low_bits);
+  HighSubsetWalk walk(kcal, protein, count, low_bits, 0);
+  for (uint64_t i = 0; i < blocks; i++) {
+    if (i > 0) {
+      walk.step(i);
+    }
+    const __m256i block_kcal = _mm256_add_epi32(_mm256_set1_epi32(walk.kcal()), low_kcal);
+    const __m256i over = _mm256_cmpgt_epi32(block_kcal, budget);
+    for (unsigned lanes = ~_mm256_movemask_ps(_mm256_castsi256_ps(over)) & 0xff;
+	 lanes != 0;
+	 lanes &= lanes - 1) {
+      const int l = lowest_set_bit(lanes);
+      output.push_back(HalfSubset{walk.kcal() + lane_kcal[l],
+				  walk.protein_g() + lane_protein[l],
+				  uint32_t((walk.mask() << low_bits) | l)});
+    }
+  }
+}
+
+// AVX-512 kernel: as subset_sum_scan_avx2, with blocks of 16
+// bitmasks, one per combination of the 4 low foods.
+__attribute__((target("avx512f")))
+void subset_sum_scan_avx512(GrayCodeBest& best,
+			    const int32_t* kcal,
+			    const int32_t* protein,
+			    int n,
+			    uint64_t first,
+			    uint64_t last,
+			    int total_kcal) {
+  const int low_bits = 4;
+  if (first >= last) {
+    return;
+  }
+  alignas(64) int32_t lane_kcal[16], lane_protein[16];
+  low_subset_sums(lane_kcal, lane_protein, kcal, protein, low_bits);
+  const __m512i low_kcal = _mm512_load_si512(lane_kcal),
+    low_protein = _mm512_load_si512(lane_protein),
+    budget = _mm512_set1_epi32(total_kcal);
+  HighSubsetWalk walk(kcal, protein, n, low_bits, first);
+  for (uint64_t i = first; i < last; i++) {
+    if (i > first) {
+      walk.step(i);
+    }
+    const __m512i block_kcal = _mm512_add_epi32(_mm512_set1_epi32(walk.kcal()), low_kcal),
+      block_protein = _mm512_add_epi32(_mm512_set1_epi32(walk.protein_g()), low_protein);
+    const __mmask16 fits = _mm512_cmple_epi32_mask(block_kcal, budget);
+    // lanes that fit and have at least the best protein so far
+    for (unsigned lanes = _mm512_mask_cmpge_epi32_mask(fits, block_protein,
+						       _mm512_set1_epi32(best.protein_g));
+	 lanes != 0;
+	 lanes &= lanes - 1) {
+      const int l = lowest_set_bit(lanes);
+      best.offer(walk.protein_g() + lane_protein[l], (walk.mask() << low_bits) | l);
+    }
+  }
+}
+
+// AVX-512 kernel: as gray_code_collect, sixteen bitmasks at a time.
+__attribute__((target("avx512f")))
+void subset_sum_collect_avx512(std::vector<HalfSubset>& output,
+			       const int32_t* kcal,
+			       const int32_t* protein,
+			       int count,
+			       int total_kcal) {
+  const int low_bits = 4;
+  assert(count < 32 && count >= low_bits);
+  alignas(64) int32_t lane_kcal[16], lane_protein[16];
+  low_subset_sums(lane_kcal, lane_protein, kcal, protein, low_bits);
+  const __m512i low_kcal = _mm512_load_si512(lane_kcal),
+    budget = _mm512_set1_epi32(total_kcal);
+  const uint64_t blocks = uint64_t(1) << (count - low_bits);
+  HighSubsetWalk walk(kcal, protein, count, low_bits, 0);
+  for (uint64_t i = 0; i < blocks; i++) {
+    if (i > 0) {
+      walk.step(i);
+    }
+    const __m512i block_kcal = _mm512_add_epi32(_mm512_set1_epi32(walk.kcal()), low_kcal);
+    for (unsigned lanes = _mm512_cmple_epi32_mask(block_kcal, budget);
+	 lanes != 0;
+	 lanes &= lanes - 1) {
+      const int l = lowest_set_bit(lanes);
+      output.push_back(HalfSubset{walk.kcal() + lane_kcal[l],
+				  walk.protein_g() + lane_protein[l],
+				  uint32_t((walk.mask() << low_bits) | l)});
+    }
+  }
+}
+
+#endif
+
+// Scan the subsets of the n foods whose high foods have Gray-code
+// ranks first through last - 1, offering each one that fits within
+// total_kcal to best. There are 2^(n - subset_sum_low_bits(kernel))
+// ranks in all; get kernel from subset_sum_kernel_for(n, ...).
+void subset_sum_scan(GrayCodeBest& best,
+		     const int32_t* kcal,
+		     const int32_t* protein,
+		     int n,
+		     uint64_t first,
+		     uint64_t last,
+		     int total_kcal,
+		     SubsetSumKernel kernel) {
+  assert(n >= subset_sum_low_bits(kernel));
+  switch (kernel) {
+#ifdef SUBSETSUM_X86
+  case SubsetSumKernel::avx2:
+    subset_sum_scan_avx2(best, kcal, protein, n, first, last, total_kcal);
+    break;
+  case SubsetSumKernel::avx512:
+    subset_sum_scan_avx512(best, kcal, protein, n, first, last, total_kcal);
+    break;
+#endif
+  default:
+    gray_code_scan(best, kcal, protein, n, first, last, total_kcal);
+    break;
+  }
+}
+
+// Append every subset of the count foods whose calories fit within
+// total_kcal to output, in an order that depends on the kernel.
+void subset_sum_collect(std::vector<HalfSubset>& output,
+			const int32_t* kcal,
+			const int32_t* protein,
+			int count,
+			int total_kcal,
+			SubsetSumKernel kernel) {
+  switch (subset_sum_kernel_for(count, kernel)) {
+#ifdef SUBSETSUM_X86
+  case SubsetSumKernel::avx2:
+    subset_sum_collect_avx2(output, kcal, protein, count, total_kcal);
+    break;
+  case SubsetSumKernel::avx512:
+    subset_sum_collect_avx512(output, kcal, protein, count, total_kcal);
+    break;
+#endif
+  default:
+    gray_code_collect(output, kcal, protein, count, total_kcal);
+    break;
+  }
+}
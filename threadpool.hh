@@ -0,0 +1,165 @@
+///////////////////////////////////////////////////////////////////////////////
+// threadpool.hh
+//
+// A fixed-size pool of worker threads that run submitted tasks. Each
+// task has a priority, and workers take the oldest task of the highest
+// priority first. The queue may be bounded, so that a burst of
+// requests blocks or is turned away instead of piling up.
+//
+// How to use:
+//
+//    ThreadPool pool(4);
+//    std::future<int> answer = pool.submit([]() { return 6 * 7; });
+//    int x = answer.get();  // waits for the task; rethrows its exception
+//
+//    ThreadPool bounded(4, 100);  // at most 100 tasks waiting
+//    std::future<int> later;
+//    if (!bounded.try_submit(later, []() { return 1; }, TaskPriority::low)) {
+//      // the queue is full; try again later
+//    }
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Tasks of a higher priority run before any waiting task of a lower
+// one, so a steady stream of high tasks can delay low tasks
+// indefinitely.
+enum class TaskPriority {
+  high,
+  normal,
+  low,
+  count
+};
+
+class ThreadPool {
+public:
+  // Start threads worker threads; 0 means one per hardware thread. If
+  // capacity is positive, at most that many tasks wait in the queue,
+  // not counting those running.
+  explicit ThreadPool(int threads = 0, size_t capacity = 0)
+    : _capacity(capacity),
+      _queued(0),
+      _stopping(false) {
+    if (threads <= 0) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < threads; i++) {
+      _workers.push_back(std::thread([this]() { work(); }));
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Finish every task already submitted, then stop the workers.
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+    }
+    _ready.notify_all();
+    for (auto& worker : _workers) {
+      worker.join();
+    }
+  }
+
+  int size() const { return _workers.size(); }
+
+  // Greatest number of waiting tasks, or 0 if there is no bound.
+  size_t capacity() const { return _capacity; }
+
+  // Number of tasks waiting for a worker.
+  size_t queued() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _queued;
+  }
+
+  // Queue task to run on some worker, returning a future for its
+  // result. If the queue is full, wait until there is room. A task must
+  // not submit to its own bounded pool this way, since every worker
+  // could end up waiting.
+  template <typename Task>
+  auto submit(Task task, TaskPriority priority = TaskPriority::normal)
+    -> std::future<decltype(task())> {
+    std::future<decltype(task())> result;
+    std::unique_lock<std::mutex> lock(_mutex);
+    _room.wait(lock, [this]() { return !full(); });
+    result = push(task, priority);
+    lock.unlock();
+    _ready.notify_one();
+    return result;
+  }
+
+  // Same as above, except that if the queue is full, return false at
+  // once instead of waiting, and leave result alone.
+  template <typename Task>
+  bool try_submit(std::future<decltype(std::declval<Task>()())>& result,
+		  Task task,
+		  TaskPriority priority = TaskPriority::normal) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (full()) {
+	return false;
+      }
+      result = push(task, priority);
+    }
+    _ready.notify_one();
+    return true;
+  }
+
+private:
+  bool full() const { return _capacity > 0 && _queued >= _capacity; }
+
+  // Queue task; the caller holds _mutex.
+  template <typename Task>
+  auto push(Task& task, TaskPriority priority) -> std::future<decltype(task())> {
+    typedef decltype(task()) Result;
+    std::shared_ptr<std::packaged_task<Result()>> packaged(new std::packaged_task<Result()>(task));
+    _queues[int(priority)].push_back([packaged]() { (*packaged)(); });
+    _queued++;
+    return packaged->get_future();
+  }
+
+  void work() {
+    for (;;) {
+      std::function<void()> task;
+      {
+	std::unique_lock<std::mutex> lock(_mutex);
+	_ready.wait(lock, [this]() { return _stopping || _queued > 0; });
+	if (_queued == 0) {
+	  return;
+	}
+	for (auto& queue : _queues) {
+	  if (!queue.empty()) {
+	    task = std::move(queue.front());
+	    queue.pop_front();
+	    break;
+	  }
+	}
+	_queued--;
+      }
+      _room.notify_one();
+      task();
+    }
+  }
+
+  std::vector<std::thread> _workers;
+  std::deque<std::function<void()>> _queues[int(TaskPriority::count)];
+  const size_t _capacity;
+  size_t _queued;
+  mutable std::mutex _mutex;
+  std::condition_variable _ready, _room;
+  bool _stopping;
+};